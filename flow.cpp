@@ -1,10 +1,15 @@
 #include <xcb/xcb.h>
 #include <xcb/xproto.h>
+#include <xcb/randr.h>
+#include <xcb/screensaver.h>
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <charconv>
 #include <cstring>
 #include <cstdlib>
+#include <cerrno>
 #include <dirent.h>
 #include <unistd.h>
 #include <ctime>
@@ -14,6 +19,23 @@
 #include <sstream>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <unordered_map>
+#include <map>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <fcntl.h>
+#include <elf.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <signal.h>
 
 // Constants for dimensions
 const int HEIGHT = 40;
@@ -27,6 +49,1101 @@ const int SETTINGS_HEIGHT = 200;
 const int VOL_WIDTH = 200;
 const int VOL_HEIGHT = 60;
 
+// Idle prefetch tuning
+const uint32_t IDLE_MS = 5000;           // no input for this long counts as idle
+const int PREFETCH_INTERVAL = 30 * 60;   // re-warm the page cache at most this often
+const unsigned DEFAULT_PREFETCH_APPS = 5;
+const unsigned DEFAULT_PREFETCH_BUDGET_MB = 64;
+
+// Async job tuning
+const size_t JOB_WORKERS = 4;
+const size_t JOB_QUEUE_CAPACITY = 64;
+const double SLOW_JOB_MS = 1000.0;       // jobs slower than this are logged
+
+// RandR notifications we select on the root window
+const uint16_t RANDR_NOTIFY_MASK = XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE |
+                                   XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE |
+                                   XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE;
+
+// Live restart snapshot format ("FLOWSNP1"); bump the version whenever the layout changes.
+const uint64_t SNAPSHOT_MAGIC = 0x31504e53574f4c46ULL;
+const uint32_t SNAPSHOT_VERSION = 2;
+
+//
+// WorkQueue runs blocking desktop operations (GIO, GSettings, file I/O) on a small pool of
+// worker threads, so a slow NFS mount or a hung D-Bus activation never stalls the X event
+// thread. A job is a work function that runs on a worker plus an optional completion that
+// runs back on the main thread; finished jobs are announced through an eventfd which run()
+// polls next to the X connection. The completion runs exactly once for every accepted job,
+// cancelled or not, and only once the job has left its worker: owners that allow one job
+// in flight clear their job id there, never when they merely ask for cancellation.
+//
+// Work functions must not touch Desktop state: they receive everything by value and hand
+// results to their completion. The internal state is shared with the workers, so a worker
+// stuck in a blocking call can be abandoned at exit without joining it.
+//
+class WorkQueue {
+public:
+    typedef uint64_t JobId;
+    typedef std::function<void(const std::atomic<bool> &cancelled)> Work;
+    typedef std::function<void(bool cancelled)> Completion;
+
+    // Per job-kind latency metrics: wait is enqueue-to-start, run is start-to-finish.
+    struct Stats {
+        uint64_t completed = 0, cancelled = 0, rejected = 0;
+        double totalWaitMs = 0, maxWaitMs = 0;
+        double totalRunMs = 0, maxRunMs = 0;
+    };
+
+    WorkQueue(size_t workers, size_t capacity);
+    ~WorkQueue();
+    bool start();
+    int fd() const { return state->eventFd; }
+    JobId submit(const char *kind, Work work, Completion done = nullptr);
+    bool cancel(JobId id);
+    void cancelAll();
+    void dispatchCompletions();
+    std::map<std::string, Stats> stats() const;
+    void restoreStats(const std::map<std::string, Stats> &saved);
+    void logStats() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Job {
+        JobId id;
+        std::string kind;
+        Work work;
+        Completion done;
+        std::atomic<bool> cancelled{false};
+        Clock::time_point queued, started, finished;
+    };
+
+    struct State {
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<std::shared_ptr<Job>> pending;
+        std::deque<std::shared_ptr<Job>> completed;
+        std::map<JobId, std::shared_ptr<Job>> running;
+        std::map<std::string, Stats> stats;
+        JobId nextId = 1;
+        bool stopping = false;
+        int eventFd = -1;
+        ~State() {
+            if (eventFd >= 0)
+                close(eventFd);
+        }
+    };
+
+    std::shared_ptr<State> state;
+    size_t workerCount;
+    size_t capacity;
+
+    static void workerLoop(std::shared_ptr<State> state);
+    static void postCompleted(State &state, std::shared_ptr<Job> job);
+    static double millis(Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+};
+
+WorkQueue::WorkQueue(size_t workers, size_t capacity)
+    : state(std::make_shared<State>()), workerCount(workers), capacity(capacity)
+{}
+
+//
+// The destructor wakes idle workers and detaches them all. A worker blocked inside a job
+// keeps the shared state alive until it returns, and its result is simply dropped.
+//
+WorkQueue::~WorkQueue() {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->stopping = true;
+    state->pending.clear();
+    for (auto &r : state->running)
+        r.second->cancelled = true;
+    state->wake.notify_all();
+}
+
+//
+// start() creates the completion eventfd and spawns the worker threads.
+//
+bool WorkQueue::start() {
+    state->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (state->eventFd < 0)
+        return false;
+    for (size_t i = 0; i < workerCount; ++i)
+        std::thread(workerLoop, state).detach();
+    return true;
+}
+
+//
+// submit() queues a job and returns its id, or 0 when the queue is full. Rejecting work
+// keeps memory bounded when every worker is stuck; callers just try again later.
+//
+WorkQueue::JobId WorkQueue::submit(const char *kind, Work work, Completion done) {
+    auto job = std::make_shared<Job>();
+    job->kind = kind;
+    job->work = std::move(work);
+    job->done = std::move(done);
+    job->queued = Clock::now();
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->pending.size() >= capacity) {
+        state->stats[job->kind].rejected++;
+        std::cerr << "flow: job queue full, dropping " << kind << std::endl;
+        return 0;
+    }
+    job->id = state->nextId++;
+    state->pending.push_back(job);
+    state->wake.notify_one();
+    return job->id;
+}
+
+//
+// cancel() takes a queued job off the queue, or flags a running one so its work can bail
+// out early. Either way its completion later runs with cancelled = true; for a running job
+// that is only after the worker is done with it. Returns false when the job already finished.
+//
+bool WorkQueue::cancel(JobId id) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    for (auto it = state->pending.begin(); it != state->pending.end(); ++it) {
+        if ((*it)->id == id) {
+            std::shared_ptr<Job> job = *it;
+            state->pending.erase(it);
+            job->cancelled = true;
+            postCompleted(*state, job);
+            return true;
+        }
+    }
+    auto it = state->running.find(id);
+    if (it == state->running.end())
+        return false;
+    it->second->cancelled = true;
+    return true;
+}
+
+void WorkQueue::cancelAll() {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    for (const auto &job : state->pending) {
+        job->cancelled = true;
+        postCompleted(*state, job);
+    }
+    state->pending.clear();
+    for (auto &r : state->running)
+        r.second->cancelled = true;
+}
+
+//
+// postCompleted() hands a job to the main thread. Called with the mutex held.
+//
+void WorkQueue::postCompleted(State &state, std::shared_ptr<Job> job) {
+    state.completed.push_back(std::move(job));
+    uint64_t one = 1;
+    if (write(state.eventFd, &one, sizeof(one)) < 0) {
+        // The counter can only overflow if the main loop stopped reading; nothing to do.
+    }
+}
+
+//
+// workerLoop() takes jobs off the pending queue until the WorkQueue is destroyed.
+//
+void WorkQueue::workerLoop(std::shared_ptr<State> state) {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    for (;;) {
+        state->wake.wait(lock, [&] { return state->stopping || !state->pending.empty(); });
+        if (state->stopping)
+            return;
+        std::shared_ptr<Job> job = state->pending.front();
+        state->pending.pop_front();
+        state->running[job->id] = job;
+        job->started = Clock::now();
+
+        lock.unlock();
+        job->work(job->cancelled);
+        lock.lock();
+
+        job->finished = Clock::now();
+        state->running.erase(job->id);
+        if (state->stopping)
+            return;
+        postCompleted(*state, job);
+    }
+}
+
+//
+// dispatchCompletions() is called on the main thread when the eventfd is readable.
+// It records the metrics of every finished job and runs every completion, telling it
+// whether the job was cancelled.
+//
+void WorkQueue::dispatchCompletions() {
+    uint64_t count;
+    if (read(state->eventFd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        return;
+
+    std::deque<std::shared_ptr<Job>> done;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        done.swap(state->completed);
+        for (const auto &job : done) {
+            Stats &st = state->stats[job->kind];
+            if (job->cancelled) {
+                st.cancelled++;
+                continue;
+            }
+            double waitMs = millis(job->queued, job->started);
+            double runMs = millis(job->started, job->finished);
+            st.completed++;
+            st.totalWaitMs += waitMs;
+            st.maxWaitMs = std::max(st.maxWaitMs, waitMs);
+            st.totalRunMs += runMs;
+            st.maxRunMs = std::max(st.maxRunMs, runMs);
+            if (runMs > SLOW_JOB_MS)
+                std::cerr << "flow: slow job " << job->kind << ": " << runMs << " ms" << std::endl;
+        }
+    }
+    for (const auto &job : done)
+        if (job->done)
+            job->done(job->cancelled);
+}
+
+std::map<std::string, WorkQueue::Stats> WorkQueue::stats() const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->stats;
+}
+
+//
+// restoreStats() carries the metrics of a previous process over a live restart.
+//
+void WorkQueue::restoreStats(const std::map<std::string, Stats> &saved) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    for (const auto &s : saved)
+        state->stats[s.first] = s.second;
+}
+
+//
+// logStats() prints the per-kind metrics, plus any job that is still running (a stuck job
+// never completes, so it would otherwise be invisible in the numbers).
+//
+void WorkQueue::logStats() const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    for (const auto &s : state->stats) {
+        const Stats &st = s.second;
+        std::cerr << "flow: job " << s.first << ": " << st.completed << " done, "
+                  << st.cancelled << " cancelled, " << st.rejected << " rejected";
+        if (st.completed)
+            std::cerr << ", wait avg " << st.totalWaitMs / st.completed << " ms max " << st.maxWaitMs
+                      << " ms, run avg " << st.totalRunMs / st.completed << " ms max " << st.maxRunMs << " ms";
+        std::cerr << std::endl;
+    }
+    Clock::time_point now = Clock::now();
+    for (const auto &r : state->running)
+        std::cerr << "flow: job " << r.second->kind << " still running after "
+                  << millis(r.second->started, now) << " ms" << std::endl;
+}
+
+//
+// LaunchHistory remembers how often and how recently each application was launched.
+// Every launch is appended to ~/.local/share/flow/launches.log as a "count last path" line;
+// load() folds repeated lines together and rewrites the log compacted.
+//
+class LaunchHistory {
+public:
+    void load();
+    void recordLaunch(const std::string &desktopFile, time_t when);
+    const std::string &logFile() const { return logPath; }
+    static void appendToLog(const std::string &logPath, const std::string &desktopFile, time_t when);
+    double frecency(const std::string &desktopFile, time_t now) const;
+    std::vector<std::string> topApps(size_t n) const;
+
+private:
+    struct Record {
+        unsigned count;
+        time_t last;
+    };
+    std::string logPath;
+    std::unordered_map<std::string, Record> records;
+
+    void compact();
+};
+
+//
+// load() reads the launch log, drops entries whose .desktop file is gone and compacts it.
+//
+void LaunchHistory::load() {
+    const char* home = getenv("HOME");
+    if (!home)
+        return;
+    std::string dir = std::string(home) + "/.local/share/flow";
+    mkdir((std::string(home) + "/.local").c_str(), 0755);
+    mkdir((std::string(home) + "/.local/share").c_str(), 0755);
+    mkdir(dir.c_str(), 0755);
+    logPath = dir + "/launches.log";
+
+    std::ifstream infile(logPath);
+    std::string line;
+    size_t lines = 0;
+    while (getline(infile, line)) {
+        ++lines;
+        unsigned count;
+        long long last;
+        int consumed = 0;
+        if (sscanf(line.c_str(), "%u %lld %n", &count, &last, &consumed) < 2 || consumed == 0)
+            continue;
+        std::string path = line.substr(consumed);
+        if (path.empty())
+            continue;
+        Record &r = records[path];
+        r.count += count;
+        r.last = std::max(r.last, static_cast<time_t>(last));
+    }
+    for (auto it = records.begin(); it != records.end();) {
+        if (access(it->first.c_str(), F_OK) != 0)
+            it = records.erase(it);
+        else
+            ++it;
+    }
+    if (lines != records.size())
+        compact();
+}
+
+//
+// compact() rewrites the log with one line per application (via a temp file and rename).
+//
+void LaunchHistory::compact() {
+    std::string tmpPath = logPath + ".tmp";
+    std::ofstream out(tmpPath, std::ios::trunc);
+    if (!out.is_open())
+        return;
+    for (const auto &r : records)
+        out << r.second.count << ' ' << static_cast<long long>(r.second.last) << ' ' << r.first << '\n';
+    out.close();
+    if (out.fail() || rename(tmpPath.c_str(), logPath.c_str()) != 0)
+        unlink(tmpPath.c_str());
+}
+
+//
+// recordLaunch() bumps the in-memory record of a launch.
+//
+void LaunchHistory::recordLaunch(const std::string &desktopFile, time_t when) {
+    Record &r = records[desktopFile];
+    r.count++;
+    r.last = when;
+}
+
+//
+// appendToLog() appends a single line to the log. O_APPEND keeps the write atomic, so the
+// log never needs rewriting on the hot path. It only touches its arguments, which lets
+// the launch job call it from a worker thread.
+//
+void LaunchHistory::appendToLog(const std::string &logPath, const std::string &desktopFile, time_t when) {
+    if (logPath.empty())
+        return;
+    int fd = open(logPath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return;
+    std::string line = "1 " + std::to_string(static_cast<long long>(when)) + " " + desktopFile + "\n";
+    if (write(fd, line.data(), line.size()) < 0)
+        std::cerr << "Cannot append to " << logPath << std::endl;
+    close(fd);
+}
+
+//
+// frecency() weights the launch count by how recently the app was last used,
+// using the same age buckets browsers use for history ranking.
+//
+double LaunchHistory::frecency(const std::string &desktopFile, time_t now) const {
+    auto it = records.find(desktopFile);
+    if (it == records.end())
+        return 0.0;
+    double days = difftime(now, it->second.last) / 86400.0;
+    double weight = days < 4 ? 100 : days < 14 ? 70 : days < 31 ? 50 : days < 90 ? 30 : 10;
+    return it->second.count * weight;
+}
+
+//
+// topApps() returns up to n desktop files ordered by descending frecency.
+//
+std::vector<std::string> LaunchHistory::topApps(size_t n) const {
+    time_t now = time(nullptr);
+    std::vector<std::pair<double, std::string>> ranked;
+    for (const auto &r : records)
+        ranked.push_back({ frecency(r.first, now), r.first });
+    std::sort(ranked.begin(), ranked.end(),
+              [](const auto &a, const auto &b) { return a.first > b.first; });
+    std::vector<std::string> top;
+    for (size_t i = 0; i < ranked.size() && i < n; ++i)
+        top.push_back(ranked[i].second);
+    return top;
+}
+
+//
+// Prefetcher warms the page cache with an executable and the shared libraries it links
+// against, so a later cold launch is served from memory instead of disk.
+//
+class Prefetcher {
+public:
+    static std::string resolveExecutable(const std::string &desktopFile);
+    static std::vector<std::string> collectFiles(const std::string &binary);
+    static size_t prefetchFile(const std::string &path, size_t budget);
+    static void evictFile(const std::string &path);
+
+private:
+    static std::vector<std::string> neededLibraries(const std::string &path);
+    static std::string findLibrary(const std::string &soname);
+};
+
+//
+// resolveExecutable() maps a .desktop file to the absolute path of the binary it runs.
+//
+std::string Prefetcher::resolveExecutable(const std::string &desktopFile) {
+    std::string result;
+    GDesktopAppInfo *app = g_desktop_app_info_new_from_filename(desktopFile.c_str());
+    if (!app)
+        return result;
+    const char *exe = g_app_info_get_executable(G_APP_INFO(app));
+    if (exe) {
+        char *full = g_find_program_in_path(exe);
+        if (full) {
+            result = full;
+            g_free(full);
+        }
+    }
+    g_object_unref(app);
+    return result;
+}
+
+//
+// neededLibraries() reads the DT_NEEDED entries from a 64-bit ELF file's dynamic section.
+// Anything that is not such a file (scripts, 32-bit binaries) simply has no dependencies.
+//
+std::vector<std::string> Prefetcher::neededLibraries(const std::string &path) {
+    std::vector<std::string> libs;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return libs;
+
+    Elf64_Ehdr eh;
+    if (pread(fd, &eh, sizeof(eh), 0) != (ssize_t)sizeof(eh) ||
+        memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0 || eh.e_ident[EI_CLASS] != ELFCLASS64 ||
+        eh.e_phentsize != sizeof(Elf64_Phdr)) {
+        close(fd);
+        return libs;
+    }
+    std::vector<Elf64_Phdr> phdrs(eh.e_phnum);
+    ssize_t phSize = (ssize_t)(phdrs.size() * sizeof(Elf64_Phdr));
+    if (pread(fd, phdrs.data(), phSize, eh.e_phoff) != phSize) {
+        close(fd);
+        return libs;
+    }
+
+    // Translate a virtual address into a file offset through the PT_LOAD segments.
+    auto toOffset = [&](Elf64_Addr addr) -> off_t {
+        for (const auto &ph : phdrs)
+            if (ph.p_type == PT_LOAD && addr >= ph.p_vaddr && addr < ph.p_vaddr + ph.p_filesz)
+                return (off_t)(addr - ph.p_vaddr + ph.p_offset);
+        return -1;
+    };
+
+    for (const auto &ph : phdrs) {
+        if (ph.p_type != PT_DYNAMIC)
+            continue;
+        std::vector<Elf64_Dyn> dyn(ph.p_filesz / sizeof(Elf64_Dyn));
+        ssize_t dynSize = (ssize_t)(dyn.size() * sizeof(Elf64_Dyn));
+        if (pread(fd, dyn.data(), dynSize, ph.p_offset) != dynSize)
+            break;
+        Elf64_Addr strtab = 0;
+        std::vector<Elf64_Xword> needed;
+        for (const auto &d : dyn) {
+            if (d.d_tag == DT_NULL)
+                break;
+            if (d.d_tag == DT_STRTAB)
+                strtab = d.d_un.d_ptr;
+            else if (d.d_tag == DT_NEEDED)
+                needed.push_back(d.d_un.d_val);
+        }
+        off_t strOff = strtab ? toOffset(strtab) : -1;
+        if (strOff < 0)
+            break;
+        for (Elf64_Xword n : needed) {
+            char name[256];
+            ssize_t got = pread(fd, name, sizeof(name) - 1, strOff + (off_t)n);
+            if (got <= 0)
+                continue;
+            name[got] = '\0';
+            libs.push_back(name);
+        }
+        break;
+    }
+    close(fd);
+    return libs;
+}
+
+//
+// findLibrary() looks a soname up in the usual system library directories.
+//
+std::string Prefetcher::findLibrary(const std::string &soname) {
+    static const char *dirs[] = {
+        "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu",
+        "/lib/aarch64-linux-gnu", "/usr/lib/aarch64-linux-gnu",
+        "/lib64", "/usr/lib64", "/lib", "/usr/lib", "/usr/local/lib",
+    };
+    if (soname.find('/') != std::string::npos)
+        return access(soname.c_str(), R_OK) == 0 ? soname : std::string();
+    for (const char *dir : dirs) {
+        std::string candidate = std::string(dir) + "/" + soname;
+        if (access(candidate.c_str(), R_OK) == 0)
+            return candidate;
+    }
+    return std::string();
+}
+
+//
+// collectFiles() returns the binary followed by its transitive shared library dependencies.
+//
+std::vector<std::string> Prefetcher::collectFiles(const std::string &binary) {
+    std::vector<std::string> files = { binary };
+    for (size_t i = 0; i < files.size(); ++i) {
+        for (const auto &soname : neededLibraries(files[i])) {
+            std::string lib = findLibrary(soname);
+            if (!lib.empty() && std::find(files.begin(), files.end(), lib) == files.end())
+                files.push_back(lib);
+        }
+    }
+    return files;
+}
+
+//
+// prefetchFile() asks the kernel to read up to `budget` bytes of a file into the page cache.
+// POSIX_FADV_WILLNEED starts the I/O asynchronously, so this returns immediately.
+// The return value is the number of bytes charged against the budget.
+//
+size_t Prefetcher::prefetchFile(const std::string &path, size_t budget) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    size_t len = 0;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        len = std::min(static_cast<size_t>(st.st_size), budget);
+        posix_fadvise(fd, 0, (off_t)len, POSIX_FADV_WILLNEED);
+    }
+    close(fd);
+    return len;
+}
+
+//
+// evictFile() drops a file's clean pages from the page cache (used by the launch benchmark).
+// Pages still mapped by running processes stay resident.
+//
+void Prefetcher::evictFile(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+//
+// Rect is a window rectangle in the coordinates of its parent.
+//
+struct Rect {
+    int16_t x, y;
+    uint16_t width, height;
+    bool operator==(const Rect &o) const {
+        return x == o.x && y == o.y && width == o.width && height == o.height;
+    }
+    bool operator!=(const Rect &o) const { return !(*this == o); }
+};
+
+//
+// Taskbar buttons from left to right, with their labels and text offsets.
+//
+enum ButtonId { BTN_APPS, BTN_TERMINAL, BTN_SETTINGS, BTN_VOLUME, BTN_THEME, BTN_ABOUT, BTN_LOGOUT, BUTTON_COUNT };
+
+static const struct {
+    const char *label;
+    int text_x;
+} BUTTONS[BUTTON_COUNT] = {
+    { "Apps", 10 }, { "Term", 5 }, { "Set", 5 }, { "Vol", 5 },
+    { "Theme", 5 }, { "About", 5 }, { "Logout", 5 },
+};
+
+//
+// TaskbarLayout is the geometry of every window in one taskbar. It is a pure function of
+// the output rectangle, so a cached copy tells us exactly which windows need to move.
+// The bar is in root coordinates; buttons and clock are relative to the bar.
+//
+struct TaskbarLayout {
+    Rect bar;
+    Rect buttons[BUTTON_COUNT];
+    Rect clock;
+
+    static TaskbarLayout compute(const Rect &output);
+};
+
+TaskbarLayout TaskbarLayout::compute(const Rect &output) {
+    TaskbarLayout layout;
+    uint16_t width = static_cast<uint16_t>(output.width * 0.8);
+    layout.bar = { static_cast<int16_t>(output.x + (output.width - width) / 2),
+                   static_cast<int16_t>(output.y + output.height - HEIGHT - 10),
+                   width, static_cast<uint16_t>(HEIGHT) };
+
+    int margin = 10;
+    int current_x = 10;
+    for (auto &button : layout.buttons) {
+        button = { static_cast<int16_t>(current_x), 5,
+                   static_cast<uint16_t>(BUTTON_WIDTH), static_cast<uint16_t>(BUTTON_HEIGHT) };
+        current_x += BUTTON_WIDTH + margin;
+    }
+
+    // Clock positioned at the far right
+    layout.clock = { static_cast<int16_t>(width - CLOCK_WIDTH - 10), 5,
+                     static_cast<uint16_t>(CLOCK_WIDTH), 30 };
+    return layout;
+}
+
+//
+// Taskbar holds the windows of the bar shown on one RandR output, together with the
+// layout they currently have. Output 0 is the whole-screen bar used without RandR.
+//
+struct Taskbar {
+    uint32_t output;
+    Rect outputRect;
+    TaskbarLayout layout;
+    xcb_window_t window;
+    xcb_window_t buttons[BUTTON_COUNT];
+    xcb_window_t clock;
+};
+
+//
+// Every window is drawn with one of these named styles. A style is a text color and a
+// background color; the background doubles as the window's background pixel.
+//
+enum StyleId { STYLE_TASKBAR, STYLE_BUTTON, STYLE_CLOCK, STYLE_MENU, STYLE_DIALOG, STYLE_VOLUME, STYLE_COUNT };
+
+static const char *STYLE_NAMES[STYLE_COUNT] = {
+    "taskbar", "button", "clock", "menu", "dialog", "volume",
+};
+
+struct Style {
+    uint32_t fg;
+    uint32_t bg;
+};
+
+//
+// Theme is a named set of styles. "dark" and "light" are built in; the config file can
+// change any of their styles or define new themes (see Config).
+// gcs holds one pre-created graphics context per style (foreground = fg, background = bg),
+// so drawing never has to call xcb_change_gc.
+//
+struct Theme {
+    std::string name;
+    Style styles[STYLE_COUNT];
+    xcb_gcontext_t gcs[STYLE_COUNT];
+};
+
+static const Theme BUILTIN_THEMES[] = {
+    { "dark", {
+        { 0xFFFFFF, 0x333333 },   // taskbar
+        { 0xFFFFFF, 0x555555 },   // button
+        { 0xFFFFFF, 0x333333 },   // clock
+        { 0xFFFFFF, 0x222222 },   // menu
+        { 0xFFFFFF, 0x444444 },   // dialog
+        { 0xFFFFFF, 0x333355 },   // volume
+    }, {} },
+    { "light", {
+        { 0x222222, 0xDDDDDD },
+        { 0x111111, 0xBBBBBB },
+        { 0x222222, 0xDDDDDD },
+        { 0x111111, 0xF0F0F0 },
+        { 0x111111, 0xE0E0E0 },
+        { 0x111111, 0xD0D0E8 },
+    }, {} },
+};
+
+//
+// StyleOverride is one "theme.<name>.<style>.<fg|bg>=<color>" line of the config file.
+//
+struct StyleOverride {
+    std::string theme;
+    StyleId style;
+    bool fg;
+    uint32_t color;
+    bool operator==(const StyleOverride &o) const {
+        return theme == o.theme && style == o.style && fg == o.fg && color == o.color;
+    }
+};
+
+//
+// ConfigError is one problem found in the config file, reported with its line number.
+//
+struct ConfigError {
+    unsigned line;
+    std::string message;
+};
+
+//
+// Config is the typed content of ~/.config/mydesktop.conf, for example:
+//   # comments and blank lines are ignored
+//   wallpaper=/my/new/wallpaper.jpg
+//   themeColor=0x444444     (taskbar and clock background of the starting theme)
+//   theme=light             (start with this theme; the Theme button cycles through all)
+//   theme.light.button.bg=0xAAAAAA
+//   theme.mine.menu.fg=0x00FF00   (a new name defines a new theme based on "dark")
+//   prefetchApps=5          (how many top apps to warm while idle, 0 disables)
+//   prefetchBudgetMB=64     (I/O budget for one prefetch pass)
+//
+// A value that fails validation is reported and the key keeps its default, so a typo
+// can never take the desktop down.
+//
+struct Config {
+    std::string wallpaper = "file:///usr/share/backgrounds/default.jpg";
+    std::string theme = "dark";
+    uint32_t themeColor = 0x333333;
+    bool hasThemeColor = false;
+    uint32_t prefetchApps = DEFAULT_PREFETCH_APPS;
+    uint32_t prefetchBudgetMB = DEFAULT_PREFETCH_BUDGET_MB;
+    std::vector<StyleOverride> styles;
+
+    bool sameColors(const Config &o) const {
+        return theme == o.theme && hasThemeColor == o.hasThemeColor &&
+               (!hasThemeColor || themeColor == o.themeColor) && styles == o.styles;
+    }
+    bool knowsTheme(const std::string &name) const {
+        return std::any_of(std::begin(BUILTIN_THEMES), std::end(BUILTIN_THEMES),
+                           [&](const Theme &t) { return t.name == name; }) ||
+               std::any_of(styles.begin(), styles.end(),
+                           [&](const StyleOverride &o) { return o.theme == name; });
+    }
+    const char *set(std::string_view key, std::string_view value);
+    static bool parse(const std::string &path, Config &out, std::vector<ConfigError> &errors);
+};
+
+//
+// The schema: every plain key, the type its value must have, and where it is stored.
+// Text keys use `text`, numeric keys use `number` (with an inclusive range) and may
+// record that they were given in `present`.
+//
+enum class ConfigType { Path, Name, Color, UInt };
+
+struct ConfigField {
+    const char *key;
+    ConfigType type;
+    std::string Config::*text;
+    uint32_t Config::*number;
+    bool Config::*present;
+    uint32_t min, max;
+};
+
+static const ConfigField CONFIG_SCHEMA[] = {
+    { "wallpaper",        ConfigType::Path,  &Config::wallpaper, nullptr, nullptr, 0, 0 },
+    { "theme",            ConfigType::Name,  &Config::theme, nullptr, nullptr, 0, 0 },
+    { "themeColor",       ConfigType::Color, nullptr, &Config::themeColor, &Config::hasThemeColor, 0, 0xFFFFFF },
+    { "prefetchApps",     ConfigType::UInt,  nullptr, &Config::prefetchApps, nullptr, 0, 100 },
+    { "prefetchBudgetMB", ConfigType::UInt,  nullptr, &Config::prefetchBudgetMB, nullptr, 0, 4096 },
+};
+
+static std::string_view trim(std::string_view v) {
+    while (!v.empty() && isspace(static_cast<unsigned char>(v.front())))
+        v.remove_prefix(1);
+    while (!v.empty() && isspace(static_cast<unsigned char>(v.back())))
+        v.remove_suffix(1);
+    return v;
+}
+
+//
+// parseColor() accepts 0xRRGGBB, #RRGGBB or bare RRGGBB.
+//
+static bool parseColor(std::string_view v, uint32_t &out) {
+    if (v.size() > 2 && v[0] == '0' && (v[1] == 'x' || v[1] == 'X'))
+        v.remove_prefix(2);
+    else if (!v.empty() && v[0] == '#')
+        v.remove_prefix(1);
+    if (v.empty() || v.size() > 6)
+        return false;
+    auto res = std::from_chars(v.data(), v.data() + v.size(), out, 16);
+    return res.ec == std::errc() && res.ptr == v.data() + v.size();
+}
+
+static bool parseUInt(std::string_view v, uint32_t &out) {
+    auto res = std::from_chars(v.data(), v.data() + v.size(), out, 10);
+    return !v.empty() && res.ec == std::errc() && res.ptr == v.data() + v.size();
+}
+
+static bool isName(std::string_view v) {
+    return !v.empty() && std::all_of(v.begin(), v.end(), [](char c) {
+        return isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_';
+    });
+}
+
+//
+// set() validates one key=value pair and stores it. Returns nullptr on success or a
+// message describing what is wrong.
+//
+const char *Config::set(std::string_view key, std::string_view value) {
+    for (const auto &field : CONFIG_SCHEMA) {
+        if (key != field.key)
+            continue;
+        uint32_t number;
+        switch (field.type) {
+            case ConfigType::Path:
+                if (value.compare(0, 7, "file://") == 0)
+                    this->*field.text = std::string(value);
+                else if (!value.empty() && value[0] == '/')
+                    this->*field.text = "file://" + std::string(value);
+                else
+                    return "expected an absolute path";
+                return nullptr;
+            case ConfigType::Name:
+                if (!isName(value))
+                    return "expected a name made of letters, digits, '-' and '_'";
+                this->*field.text = std::string(value);
+                return nullptr;
+            case ConfigType::Color:
+                if (!parseColor(value, number))
+                    return "expected a color like 0x333333";
+                break;
+            case ConfigType::UInt:
+                if (!parseUInt(value, number))
+                    return "expected a whole number";
+                if (number < field.min || number > field.max)
+                    return "value out of range";
+                break;
+        }
+        this->*field.number = number;
+        if (field.present)
+            this->*field.present = true;
+        return nullptr;
+    }
+
+    // theme.<name>.<style>.<fg|bg>
+    if (key.compare(0, 6, "theme.") != 0)
+        return "unknown key";
+    size_t attrDot = key.rfind('.');
+    size_t styleDot = key.rfind('.', attrDot - 1);
+    if (styleDot == std::string_view::npos || styleDot <= 5)
+        return "expected theme.<name>.<style>.<fg|bg>";
+    std::string_view name = key.substr(6, styleDot - 6);
+    std::string_view styleName = key.substr(styleDot + 1, attrDot - styleDot - 1);
+    std::string_view attr = key.substr(attrDot + 1);
+    if (!isName(name))
+        return "bad theme name";
+    auto it = std::find(std::begin(STYLE_NAMES), std::end(STYLE_NAMES), styleName);
+    if (it == std::end(STYLE_NAMES))
+        return "unknown style (taskbar, button, clock, menu, dialog or volume)";
+    if (attr != "fg" && attr != "bg")
+        return "expected fg or bg";
+    uint32_t color;
+    if (!parseColor(value, color))
+        return "expected a color like 0x333333";
+    styles.push_back({ std::string(name), static_cast<StyleId>(it - std::begin(STYLE_NAMES)),
+                       attr == "fg", color });
+    return nullptr;
+}
+
+//
+// parse() reads the file into a buffer that is reused across reloads and walks it with
+// string_views: no per-line copies and no exceptions; memory is only allocated to store
+// string values or to report errors. The file is read rather than mapped, since an editor
+// truncating it mid-parse would turn a mapping into SIGBUS. A `theme` naming neither a
+// built-in theme nor one defined by theme.<name>.* lines is reported and ignored.
+// Returns false if the file does not exist, leaving `out` untouched.
+//
+bool Config::parse(const std::string &path, Config &out, std::vector<ConfigError> &errors) {
+    static std::string buf;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size + 1 > buf.size())
+        buf.resize((size_t)st.st_size + 1);
+    if (buf.empty())
+        buf.resize(4096);
+    size_t size = 0;
+    for (;;) {
+        if (size == buf.size())
+            buf.resize(buf.size() * 2);
+        ssize_t n = read(fd, &buf[size], buf.size() - size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            close(fd);
+            return false;
+        }
+        if (n == 0)
+            break;
+        size += (size_t)n;
+    }
+    close(fd);
+
+    std::string_view text(buf.data(), size);
+    unsigned lineNo = 0, themeLine = 0;
+    while (!text.empty()) {
+        size_t nl = text.find('\n');
+        std::string_view line = trim(text.substr(0, nl));
+        text.remove_prefix(nl == std::string_view::npos ? text.size() : nl + 1);
+        ++lineNo;
+        if (line.empty() || line[0] == '#')
+            continue;
+        size_t eq = line.find('=');
+        if (eq == std::string_view::npos) {
+            errors.push_back({ lineNo, "expected key=value" });
+            continue;
+        }
+        std::string_view key = trim(line.substr(0, eq));
+        const char *error = out.set(key, trim(line.substr(eq + 1)));
+        if (error)
+            errors.push_back({ lineNo, std::string(key) + ": " + error });
+        else if (key == "theme")
+            themeLine = lineNo;
+    }
+    // Themes can be defined after the line that selects them.
+    if (themeLine && !out.knowsTheme(out.theme)) {
+        errors.push_back({ themeLine, "theme: unknown theme \"" + out.theme + "\"" });
+        out.theme = Config().theme;
+    }
+    return true;
+}
+
+//
+// SnapshotWriter and SnapshotReader handle the live-restart snapshot: a flat stream of
+// native-endian integers and length-prefixed strings. It only ever passes between two
+// builds on the same machine, so versioning the whole layout is all the care it needs.
+// Both sides go through a shared mapping of the file rather than read()/write().
+//
+class SnapshotWriter {
+public:
+    void u8(uint8_t v) { buf.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+    void u32(uint32_t v) { buf.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+    void u64(uint64_t v) { buf.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+    void f64(double v) { buf.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+    void str(const std::string &v) {
+        u32(static_cast<uint32_t>(v.size()));
+        buf.append(v);
+    }
+    void rect(const Rect &r) {
+        u32(static_cast<uint32_t>(static_cast<int32_t>(r.x)));
+        u32(static_cast<uint32_t>(static_cast<int32_t>(r.y)));
+        u32(r.width);
+        u32(r.height);
+    }
+    bool writeTo(std::string &path) const;
+
+private:
+    std::string buf;
+};
+
+//
+// writeTo() creates a new file from the mkstemp() template `path`, which it completes with
+// the name it picked. The file is created exclusively, so nothing planted at a guessable
+// name can be truncated or read back in its place.
+//
+bool SnapshotWriter::writeTo(std::string &path) const {
+    int fd = mkostemp(&path[0], O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool ok = false;
+    if (ftruncate(fd, (off_t)buf.size()) == 0) {
+        void *map = mmap(nullptr, buf.size(), PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            memcpy(map, buf.data(), buf.size());
+            munmap(map, buf.size());
+            ok = true;
+        }
+    }
+    close(fd);
+    if (!ok)
+        unlink(path.c_str());
+    return ok;
+}
+
+class SnapshotReader {
+public:
+    SnapshotReader() : base(nullptr), size(0), pos(0), good(false) {}
+    ~SnapshotReader() {
+        if (base)
+            munmap(const_cast<char*>(base), size);
+    }
+    bool open(const std::string &path);
+    bool ok() const { return good; }
+    bool holds(uint32_t count, size_t minSize);
+
+    uint8_t u8() { uint8_t v = 0; take(&v, sizeof(v)); return v; }
+    uint32_t u32() { uint32_t v = 0; take(&v, sizeof(v)); return v; }
+    uint64_t u64() { uint64_t v = 0; take(&v, sizeof(v)); return v; }
+    double f64() { double v = 0; take(&v, sizeof(v)); return v; }
+    std::string str() {
+        uint32_t len = u32();
+        if (!good || len > size - pos) {
+            good = false;
+            return std::string();
+        }
+        std::string v(base + pos, len);
+        pos += len;
+        return v;
+    }
+    Rect rect() {
+        Rect r;
+        r.x = static_cast<int16_t>(static_cast<int32_t>(u32()));
+        r.y = static_cast<int16_t>(static_cast<int32_t>(u32()));
+        r.width = static_cast<uint16_t>(u32());
+        r.height = static_cast<uint16_t>(u32());
+        return r;
+    }
+
+private:
+    const char *base;
+    size_t size, pos;
+    bool good;
+
+    void take(void *out, size_t n) {
+        if (!good || n > size - pos) {
+            good = false;
+            return;
+        }
+        memcpy(out, base + pos, n);
+        pos += n;
+    }
+};
+
+//
+// open() maps the snapshot read-only and unlinks it: a snapshot is adopted at most once.
+//
+//
+// open() only accepts a regular file of ours: the path comes from the command line.
+//
+bool SnapshotReader::open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()) {
+        close(fd);
+        return false;
+    }
+    unlink(path.c_str());
+    if (st.st_size > 0) {
+        void *map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            base = static_cast<const char*>(map);
+            size = (size_t)st.st_size;
+            good = true;
+        }
+    }
+    close(fd);
+    return good;
+}
+
+//
+// holds() checks that `count` items of at least `minSize` bytes each can still follow,
+// so a corrupt count fails the read instead of sizing an allocation.
+//
+bool SnapshotReader::holds(uint32_t count, size_t minSize) {
+    if (good && count > (size - pos) / minSize)
+        good = false;
+    return good;
+}
+
 //
 // The Desktop class encapsulates our desktop environment.
 // It handles setting up the taskbar, buttons, wallpaper, and events.
@@ -35,22 +1152,32 @@ class Desktop {
 public:
     Desktop();
     ~Desktop();
-    bool init();
+    bool init(const char *snapshotPath = nullptr, uint32_t retainedResource = 0);
     void run();
     void cleanup();
     
 private:
     xcb_connection_t* conn;
     xcb_screen_t* screen;
-    xcb_window_t root, taskbar;
-    xcb_window_t app_button, terminal_button, settings_button, notif_button,
-                 theme_button, about_button, logout_button, clock_win;
+    xcb_window_t root;
     xcb_window_t app_menu, settings_win, volume_win;
-    xcb_gcontext_t gc;
+    std::string settingsText;
+    Rect settingsRect;
+
+    // Themes and the active one.
+    std::vector<Theme> themes;
+    size_t currentTheme;
 
-    // Configuration values – default wallpaper and theme color (as used in the clock drawing)
-    std::string wallpaperPath;
-    uint32_t themeColor;
+    // One taskbar per active RandR output. randrEventBase is 0 when RandR is unavailable.
+    std::vector<Taskbar> taskbars;
+    uint8_t randrEventBase;
+    bool outputsDirty;
+    uint16_t screenWidth, screenHeight;
+
+    // Configuration values, and the inotify watch on the config file's directory.
+    Config config;
+    std::string configPath;
+    int configWatch;
 
     // AppEntry for holding an app’s name, desktop file path, and its y coordinate in the menu.
     struct AppEntry {
@@ -59,95 +1186,343 @@ private:
         int y;
     };
     std::vector<AppEntry> appEntries;
+    bool appMenuStale;
+
+    // Launch history drives menu ranking and idle-time prefetching. lastActivity is our own
+    // last input, only used to measure idle time without MIT-SCREEN-SAVER.
+    LaunchHistory history;
+    time_t lastActivity;
+    time_t lastPrefetch;
+
+    // Blocking GIO/GSettings/file work runs here; ids of the jobs we only want once in flight.
+    WorkQueue jobs;
+    WorkQueue::JobId appScanJob;
+    WorkQueue::JobId prefetchJob;
+
+    // Live restart: the binary to exec (re-resolved so a rebuilt file is picked up).
+    std::string exePath;
 
     // Methods
     void setupCursor();
     void loadConfig();
+    void watchConfig();
+    void handleConfigEvents();
+    void applyConfig(Config next);
+    void buildThemes(const std::string &preferred);
     void setWallpaper();
-    void drawText(xcb_window_t win, int x, int y, const std::string &txt, uint32_t color);
+    const Style &style(StyleId id) const { return themes[currentTheme].styles[id]; }
+    Theme &findTheme(const std::string &name);
+    void createStyleGCs();
+    void freeStyleGCs();
+    void applyTheme(size_t index);
+    void paintWindow(xcb_window_t win);
+    void drawText(xcb_window_t win, StyleId id, int x, int y, const std::string &txt);
     void launchApp(const std::string &desktopFile);
     void launchTerminal();
     void showAppMenu();
+    void scanApps();
+    void drawAppMenu();
     void handleAppMenuClick(int click_y);
+    xcb_window_t createPopup(const Rect &r, StyleId id, uint32_t eventMask);
     void showSettings();
+    void openDialog(const std::string &text, const Rect &r);
     void showVolume();
     void changeVolume(const std::string &cmd);
     void grabKeys();
+    void ungrabKeys();
+    void selectInput(bool enabled);
     void drawClock();
-    void createTaskbar();
+    void drawClock(const Taskbar &bar);
+    void initRandR();
+    std::vector<std::pair<uint32_t, Rect>> queryOutputs();
+    void updateOutputs();
+    void createTaskbar(uint32_t output, const Rect &outputRect);
+    void relayoutTaskbar(Taskbar &bar, const Rect &outputRect);
+    void moveResize(xcb_window_t win, const Rect &from, const Rect &to);
+    bool findButton(xcb_window_t win, ButtonId &id) const;
+    const Taskbar* findClock(xcb_window_t win) const;
     void processEvent(xcb_generic_event_t* e);
+    uint32_t userIdleMs();
+    void idlePrefetch();
+    void installRestartHandler();
+    std::string snapshotPath() const;
+    bool writeSnapshot(std::string &path, uint64_t startNs);
+    bool adoptSnapshot(const std::string &path, uint32_t retainedResource);
+    bool releaseRetained(uint32_t resource);
+    void liveRestart();
     std::string getTimeString();
 };
 
 //
-// Constructor: set defaults for our configuration and initialize members.
+// SIGHUP requests a live restart. The handler only pokes a self-pipe that run() polls.
+//
+static int restartPipe[2] = { -1, -1 };
+
+static void onRestartSignal(int) {
+    char c = 0;
+    if (write(restartPipe[1], &c, 1) < 0) {
+        // A restart is already pending.
+    }
+}
+
+static uint64_t monotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+//
+// Constructor: set defaults for our configuration and initialize members.
+//
+Desktop::Desktop() 
+    : conn(nullptr), screen(nullptr), root(0),
+      app_menu(0), settings_win(0), volume_win(0), settingsRect(), currentTheme(0),
+      randrEventBase(0), outputsDirty(false), screenWidth(0), screenHeight(0), configWatch(-1),
+      appMenuStale(false), lastActivity(0), lastPrefetch(0),
+      jobs(JOB_WORKERS, JOB_QUEUE_CAPACITY), appScanJob(0), prefetchJob(0)
+{}
+
+//
+// Destructor – ensure cleanup is called.
+//
+Desktop::~Desktop() {
+    cleanup();
+}
+
+//
+// init() connects to X, loads config values, creates a taskbar with several buttons on
+// every monitor, sets up the cursor and wallpaper, and grabs the key events we need.
+// After a live restart it carries on from the snapshot instead (see adoptSnapshot()).
+//
+bool Desktop::init(const char *snapshotPath, uint32_t retainedResource) {
+    conn = xcb_connect(nullptr, nullptr);
+    if (xcb_connection_has_error(conn)) {
+        std::cerr << "Cannot connect to X server" << std::endl;
+        return false;
+    }
+    if (!jobs.start()) {
+        std::cerr << "Cannot start worker threads" << std::endl;
+        return false;
+    }
+    screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+    root = screen->root;
+    screenWidth = screen->width_in_pixels;
+    screenHeight = screen->height_in_pixels;
+
+    loadConfig();
+    watchConfig();
+    history.load();
+    lastActivity = time(nullptr);
+
+    installRestartHandler();
+
+    if (!snapshotPath || !adoptSnapshot(snapshotPath, retainedResource)) {
+        createStyleGCs();
+        initRandR();
+        updateOutputs();
+        setupCursor();
+        setWallpaper();
+    }
+    grabKeys();
+
+    return true;
+}
+
+//
+// loadConfig() parses ~/.config/mydesktop.conf (see Config for the keys), reports any
+// problems with their line numbers and builds the themes.
+//
+void Desktop::loadConfig() {
+    const char* home = getenv("HOME");
+    if (home)
+        configPath = std::string(home) + "/.config/mydesktop.conf";
+    std::vector<ConfigError> errors;
+    if (!configPath.empty())
+        Config::parse(configPath, config, errors);
+    for (const auto &err : errors)
+        std::cerr << "flow: " << configPath << ":" << err.line << ": " << err.message << std::endl;
+    buildThemes(config.theme);
+}
+
+//
+// watchConfig() watches the config file's directory rather than the file itself, because
+// editors usually save by writing a new file and renaming it over the old one.
+//
+void Desktop::watchConfig() {
+    if (configPath.empty())
+        return;
+    configWatch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (configWatch < 0)
+        return;
+    std::string dir = configPath.substr(0, configPath.rfind('/'));
+    if (inotify_add_watch(configWatch, dir.c_str(),
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+        close(configWatch);
+        configWatch = -1;
+    }
+}
+
+//
+// handleConfigEvents() drains the inotify queue and reloads the config once if any event
+// was about our file. An invalid value is reported and falls back to its default; a file
+// that cannot be read (editors briefly remove it while saving) keeps the current config.
+//
+void Desktop::handleConfigEvents() {
+    alignas(struct inotify_event) char buf[4096];
+    std::string_view name(configPath);
+    name.remove_prefix(name.rfind('/') + 1);
+    bool changed = false;
+    ssize_t len;
+    while ((len = read(configWatch, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len;) {
+            auto *ev = reinterpret_cast<struct inotify_event*>(p);
+            if (ev->len && name == ev->name)
+                changed = true;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    if (!changed)
+        return;
+
+    Config next;
+    std::vector<ConfigError> errors;
+    if (!Config::parse(configPath, next, errors))
+        return;
+    for (const auto &err : errors)
+        std::cerr << "flow: " << configPath << ":" << err.line << ": " << err.message << std::endl;
+    applyConfig(std::move(next));
+}
+
+//
+// applyConfig() diffs the new config against the current one and only re-applies what
+// changed: the wallpaper is set again only when its path changed, styles are rebuilt and
+// repainted only when a color or the theme changed, and a prefetch pass is rerun only
+// when its settings changed. A theme the user switched to survives unrelated edits.
+//
+void Desktop::applyConfig(Config next) {
+    bool wallpaperChanged = next.wallpaper != config.wallpaper;
+    bool colorsChanged = !next.sameColors(config);
+    bool themeChanged = next.theme != config.theme;
+    bool prefetchChanged = next.prefetchApps != config.prefetchApps ||
+                           next.prefetchBudgetMB != config.prefetchBudgetMB;
+    std::string active = themes[currentTheme].name;
+    config = std::move(next);
+
+    if (colorsChanged) {
+        freeStyleGCs();
+        buildThemes(themeChanged ? config.theme : active);
+        createStyleGCs();
+        applyTheme(currentTheme);
+    }
+    if (wallpaperChanged)
+        setWallpaper();
+    if (prefetchChanged) {
+        if (prefetchJob)
+            jobs.cancel(prefetchJob);
+        lastPrefetch = 0;
+    }
+}
+
+//
+// buildThemes() starts from the built-in themes, applies the config's style overrides and
+// selects `preferred` (or the config's starting theme if that no longer exists).
+// themeColor keeps its old meaning: the taskbar and clock background of the starting theme.
+//
+void Desktop::buildThemes(const std::string &preferred) {
+    themes.assign(std::begin(BUILTIN_THEMES), std::end(BUILTIN_THEMES));
+    for (const auto &o : config.styles) {
+        Style &st = findTheme(o.theme).styles[o.style];
+        (o.fg ? st.fg : st.bg) = o.color;
+    }
+    Theme &start = findTheme(config.theme);
+    if (config.hasThemeColor) {
+        start.styles[STYLE_TASKBAR].bg = config.themeColor;
+        start.styles[STYLE_CLOCK].bg = config.themeColor;
+    }
+    currentTheme = &start - themes.data();
+    for (size_t i = 0; i < themes.size(); ++i)
+        if (themes[i].name == preferred)
+            currentTheme = i;
+}
+
+//
+// findTheme() returns the theme with the given name, creating it as a copy of the first
+// built-in theme if it does not exist yet.
 //
-Desktop::Desktop() 
-    : conn(nullptr), screen(nullptr), root(0), taskbar(0),
-      app_button(0), terminal_button(0), settings_button(0), notif_button(0),
-      theme_button(0), about_button(0), logout_button(0), clock_win(0),
-      app_menu(0), settings_win(0), volume_win(0), gc(0),
-      wallpaperPath("file:///usr/share/backgrounds/default.jpg"),
-      themeColor(0x333333) // initial theme color for backgrounds
-{}
+Theme &Desktop::findTheme(const std::string &name) {
+    for (auto &theme : themes)
+        if (theme.name == name)
+            return theme;
+    themes.push_back(BUILTIN_THEMES[0]);
+    themes.back().name = name;
+    return themes.back();
+}
 
 //
-// Destructor – ensure cleanup is called.
+// createStyleGCs() creates the graphics contexts of every style of every theme up front.
+// There are only a handful, and it makes a theme switch a matter of picking another set.
 //
-Desktop::~Desktop() {
-    cleanup();
+void Desktop::createStyleGCs() {
+    for (auto &theme : themes) {
+        for (int i = 0; i < STYLE_COUNT; ++i) {
+            uint32_t values[] = { theme.styles[i].fg, theme.styles[i].bg };
+            theme.gcs[i] = xcb_generate_id(conn);
+            xcb_create_gc(conn, theme.gcs[i], root, XCB_GC_FOREGROUND | XCB_GC_BACKGROUND, values);
+        }
+    }
+}
+
+void Desktop::freeStyleGCs() {
+    for (auto &theme : themes) {
+        for (auto &gc : theme.gcs) {
+            if (gc)
+                xcb_free_gc(conn, gc);
+            gc = 0;
+        }
+    }
 }
 
 //
-// init() connects to X, loads config values, creates the taskbar with several buttons,
-// sets up the cursor and wallpaper, and grabs the key events we need.
+// applyTheme() switches to another theme in a single batch: every window gets its new
+// background pixel, is cleared and repainted, and the whole lot goes out in one flush.
 //
-bool Desktop::init() {
-    conn = xcb_connect(nullptr, nullptr);
-    if (xcb_connection_has_error(conn)) {
-        std::cerr << "Cannot connect to X server" << std::endl;
-        return false;
+void Desktop::applyTheme(size_t index) {
+    currentTheme = index;
+    auto restyle = [&](xcb_window_t win, StyleId id) {
+        if (!win)
+            return;
+        xcb_change_window_attributes(conn, win, XCB_CW_BACK_PIXEL, &style(id).bg);
+        xcb_clear_area(conn, 0, win, 0, 0, 0, 0);
+        paintWindow(win);
+    };
+    for (const auto &bar : taskbars) {
+        restyle(bar.window, STYLE_TASKBAR);
+        for (xcb_window_t button : bar.buttons)
+            restyle(button, STYLE_BUTTON);
+        restyle(bar.clock, STYLE_CLOCK);
     }
-    screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
-    root = screen->root;
-
-    loadConfig();
-    createTaskbar();
-    setupCursor();
-    setWallpaper();
-    grabKeys();
-
-    return true;
+    restyle(app_menu, STYLE_MENU);
+    restyle(settings_win, STYLE_DIALOG);
+    restyle(volume_win, STYLE_VOLUME);
+    xcb_flush(conn);
 }
 
 //
-// loadConfig() attempts to open ~/.config/mydesktop.conf and parse key=value pairs.
-// For example:
-//   wallpaper=/my/new/wallpaper.jpg
-//   themeColor=0x444444
+// paintWindow() draws the contents of any of our windows. Expose handling and theme
+// switches both go through here.
 //
-void Desktop::loadConfig() {
-    const char* home = getenv("HOME");
-    if (!home)
-        return;
-    std::string configPath = std::string(home) + "/.config/mydesktop.conf";
-    std::ifstream infile(configPath);
-    if (infile.is_open()) {
-        std::string line;
-        while (getline(infile, line)) {
-            size_t pos = line.find('=');
-            if (pos == std::string::npos)
-                continue;
-            std::string key = line.substr(0, pos);
-            std::string value = line.substr(pos + 1);
-            if (key == "wallpaper") {
-                wallpaperPath = "file://" + value;
-            } else if (key == "themeColor") {
-                themeColor = std::stoul(value, nullptr, 16);
-            }
-        }
-        infile.close();
-    }
+void Desktop::paintWindow(xcb_window_t win) {
+    ButtonId id;
+    if (findButton(win, id))
+        drawText(win, STYLE_BUTTON, BUTTONS[id].text_x, 20, BUTTONS[id].label);
+    else if (const Taskbar *bar = findClock(win))
+        drawClock(*bar);
+    else if (win == app_menu)
+        drawAppMenu();
+    else if (win == settings_win)
+        drawText(settings_win, STYLE_DIALOG, 10, 20, settingsText);
+    else if (win == volume_win)
+        drawText(volume_win, STYLE_VOLUME, 10, 20, "Volume: Use keys");
 }
 
 //
@@ -166,31 +1541,49 @@ void Desktop::setupCursor() {
 //
 // setWallpaper() uses GSettings to set the desktop background.
 // (You can later extend this to support themes dynamically.)
+// GSettings may have to start dconf over D-Bus, so this runs as a job.
 //
 void Desktop::setWallpaper() {
-    GSettings *settings = g_settings_new("org.gnome.desktop.background");
-    g_settings_set_string(settings, "picture-uri", wallpaperPath.c_str());
-    g_object_unref(settings);
+    std::string uri = config.wallpaper;
+    jobs.submit("wallpaper", [uri](const std::atomic<bool> &) {
+        GSettings *settings = g_settings_new("org.gnome.desktop.background");
+        g_settings_set_string(settings, "picture-uri", uri.c_str());
+        g_object_unref(settings);
+    });
 }
 
 //
 // drawText() is a thin wrapper around xcb_image_text_8 so that we can use C++ strings.
+// It draws with the cached GC of a style of the active theme; run() flushes once per batch.
 //
-void Desktop::drawText(xcb_window_t win, int x, int y, const std::string &txt, uint32_t color) {
-    xcb_change_gc(conn, gc, XCB_GC_FOREGROUND, &color);
-    xcb_image_text_8(conn, txt.size(), win, gc, x, y, txt.c_str());
-    xcb_flush(conn);
+void Desktop::drawText(xcb_window_t win, StyleId id, int x, int y, const std::string &txt) {
+    xcb_image_text_8(conn, txt.size(), win, themes[currentTheme].gcs[id], x, y, txt.c_str());
 }
 
 //
-// launchApp() takes a desktop file path, loads it with GDesktopAppInfo, and launches the application.
+// launchApp() takes a desktop file path, loads it with GDesktopAppInfo, and launches the
+// application on a worker (D-Bus activation can hang). Successful launches are recorded
+// so the menu and the prefetcher learn what gets used.
 //
 void Desktop::launchApp(const std::string &desktopFile) {
-    GDesktopAppInfo *app = g_desktop_app_info_new_from_filename(desktopFile.c_str());
-    if (app) {
-        g_app_info_launch(G_APP_INFO(app), nullptr, nullptr, nullptr);
+    std::string logPath = history.logFile();
+    auto launched = std::make_shared<time_t>(0);
+    jobs.submit("launch", [desktopFile, logPath, launched](const std::atomic<bool> &) {
+        GDesktopAppInfo *app = g_desktop_app_info_new_from_filename(desktopFile.c_str());
+        if (!app)
+            return;
+        if (g_app_info_launch(G_APP_INFO(app), nullptr, nullptr, nullptr)) {
+            *launched = time(nullptr);
+            LaunchHistory::appendToLog(logPath, desktopFile, *launched);
+        }
         g_object_unref(app);
-    }
+    }, [this, desktopFile, launched](bool) {
+        if (!*launched)
+            return;
+        history.recordLaunch(desktopFile, *launched);
+        appMenuStale = true;
+        lastPrefetch = 0;
+    });
 }
 
 //
@@ -205,56 +1598,96 @@ void Desktop::launchTerminal() {
 }
 
 //
-// showAppMenu() creates (or remaps) a window containing the list of installed applications
-// (by scanning XDG applications directories). Each entry is drawn and saved in an STL vector.
+// showAppMenu() creates (or remaps) a window containing the list of installed applications.
+// The list comes from scanApps(); until it is ready the menu shows "Loading...".
 //
 void Desktop::showAppMenu() {
-    if (app_menu) {
-        xcb_map_window(conn, app_menu);
-        xcb_flush(conn);
-        return;
-    }
-
-    uint32_t values[] = {0x222222, XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_BUTTON_PRESS};
-    int menu_x = 100, menu_y = 100;
-    app_menu = xcb_generate_id(conn);
-    xcb_create_window(conn, XCB_COPY_FROM_PARENT, app_menu, root,
-                      menu_x, menu_y, APP_MENU_WIDTH, APP_MENU_HEIGHT,
-                      2, XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
-                      XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK, values);
+    if (!app_menu)
+        app_menu = createPopup(Rect{ 100, 100, APP_MENU_WIDTH, APP_MENU_HEIGHT }, STYLE_MENU,
+                               XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_BUTTON_PRESS);
     xcb_map_window(conn, app_menu);
 
-    appEntries.clear();
-    int y_offset = 20;
+    if (appEntries.empty() && !appScanJob)
+        scanApps();
+    if (appMenuStale || appScanJob)
+        drawAppMenu();
+    xcb_flush(conn);
+}
+
+//
+// scanApps() collects the installed applications by scanning the XDG applications
+// directories. Parsing every .desktop file can be slow on network mounts, so it runs as
+// a job and the completion stores the entries and redraws the menu.
+//
+void Desktop::scanApps() {
     const char *xdg_data_dirs = getenv("XDG_DATA_DIRS");
     if (!xdg_data_dirs)
         xdg_data_dirs = "/usr/share:/usr/local/share";
     std::string dirsString(xdg_data_dirs);
-    std::istringstream iss(dirsString);
-    std::string token;
-    while (std::getline(iss, token, ':') && y_offset < APP_MENU_HEIGHT - 20) {
-        std::string path = token + "/applications";
-        DIR *d = opendir(path.c_str());
-        if (d) {
-            struct dirent *entry;
-            while ((entry = readdir(d)) && y_offset < APP_MENU_HEIGHT - 20) {
-                std::string entryName(entry->d_name);
-                if (entryName.find(".desktop") != std::string::npos) {
-                    std::string full_path = path + "/" + entryName;
-                    GDesktopAppInfo *app = g_desktop_app_info_new_from_filename(full_path.c_str());
-                    if (app) {
-                        const char *name = g_app_info_get_name(G_APP_INFO(app));
-                        drawText(app_menu, 10, y_offset, name, 0xFFFFFF);
-                        appEntries.push_back({ name, full_path, y_offset });
-                        y_offset += 20;
-                        g_object_unref(app);
+
+    auto scanned = std::make_shared<std::vector<AppEntry>>();
+    appScanJob = jobs.submit("scan-apps", [dirsString, scanned](const std::atomic<bool> &cancelled) {
+        std::istringstream iss(dirsString);
+        std::string token;
+        while (std::getline(iss, token, ':') && !cancelled) {
+            std::string path = token + "/applications";
+            DIR *d = opendir(path.c_str());
+            if (d) {
+                struct dirent *entry;
+                while ((entry = readdir(d)) && !cancelled) {
+                    std::string entryName(entry->d_name);
+                    if (entryName.find(".desktop") != std::string::npos) {
+                        std::string full_path = path + "/" + entryName;
+                        GDesktopAppInfo *app = g_desktop_app_info_new_from_filename(full_path.c_str());
+                        if (app) {
+                            const char *name = g_app_info_get_name(G_APP_INFO(app));
+                            scanned->push_back({ name, full_path, -1 });
+                            g_object_unref(app);
+                        }
                     }
                 }
+                closedir(d);
             }
-            closedir(d);
         }
+    }, [this, scanned](bool cancelled) {
+        appScanJob = 0;
+        if (cancelled)
+            return;
+        appEntries = std::move(*scanned);
+        appMenuStale = true;
+        if (app_menu)
+            drawAppMenu();
+    });
+}
+
+//
+// drawAppMenu() ranks the scanned entries by frecency (never-launched apps keep scan order)
+// and draws as many as fit. Entries that did not fit get y = -1 so clicks ignore them.
+//
+void Desktop::drawAppMenu() {
+    if (appMenuStale) {
+        time_t now = time(nullptr);
+        std::stable_sort(appEntries.begin(), appEntries.end(),
+                         [&](const AppEntry &a, const AppEntry &b) {
+                             return history.frecency(a.path, now) > history.frecency(b.path, now);
+                         });
+        int y_offset = 20;
+        for (auto &entry : appEntries) {
+            entry.y = y_offset < APP_MENU_HEIGHT - 20 ? y_offset : -1;
+            y_offset += 20;
+        }
+        appMenuStale = false;
+    }
+    xcb_clear_area(conn, 0, app_menu, 0, 0, APP_MENU_WIDTH, APP_MENU_HEIGHT);
+    if (appScanJob) {
+        drawText(app_menu, STYLE_MENU, 10, 20, "Loading...");
+        return;
+    }
+    for (const auto &entry : appEntries) {
+        if (entry.y < 0)
+            break;
+        drawText(app_menu, STYLE_MENU, 10, entry.y, entry.name);
     }
-    xcb_flush(conn);
 }
 
 //
@@ -263,6 +1696,8 @@ void Desktop::showAppMenu() {
 //
 void Desktop::handleAppMenuClick(int click_y) {
     for (const auto &entry : appEntries) {
+        if (entry.y < 0)
+            break;
         int entry_top = entry.y - 15;
         int entry_bottom = entry.y + 5;
         if (click_y >= entry_top && click_y <= entry_bottom) {
@@ -274,6 +1709,20 @@ void Desktop::handleAppMenuClick(int click_y) {
     }
 }
 
+//
+// createPopup() creates (but does not map) a top-level window with a 2px border,
+// filled with the background of the given style.
+//
+xcb_window_t Desktop::createPopup(const Rect &r, StyleId id, uint32_t eventMask) {
+    uint32_t values[] = {style(id).bg, eventMask};
+    xcb_window_t win = xcb_generate_id(conn);
+    xcb_create_window(conn, XCB_COPY_FROM_PARENT, win, root,
+                      r.x, r.y, r.width, r.height,
+                      2, XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
+                      XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK, values);
+    return win;
+}
+
 //
 // showSettings() creates a basic settings window (currently a stub).
 //
@@ -283,16 +1732,19 @@ void Desktop::showSettings() {
         xcb_flush(conn);
         return;
     }
+    openDialog("Settings (Coming Soon)", Rect{ 200, 200, SETTINGS_WIDTH, SETTINGS_HEIGHT });
+}
 
-    uint32_t values[] = {0x444444, XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_BUTTON_PRESS};
-    settings_win = xcb_generate_id(conn);
-    int win_x = 200, win_y = 200;
-    xcb_create_window(conn, XCB_COPY_FROM_PARENT, settings_win, root,
-                      win_x, win_y, SETTINGS_WIDTH, SETTINGS_HEIGHT,
-                      2, XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
-                      XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK, values);
+//
+// openDialog() shows `text` in a new dialog window, which the settings and about dialogs
+// share as settings_win.
+//
+void Desktop::openDialog(const std::string &text, const Rect &r) {
+    settingsText = text;
+    settingsRect = r;
+    settings_win = createPopup(r, STYLE_DIALOG, XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_BUTTON_PRESS);
     xcb_map_window(conn, settings_win);
-    drawText(settings_win, 10, 20, "Settings (Coming Soon)", 0xFFFFFF);
+    paintWindow(settings_win);
     xcb_flush(conn);
 }
 
@@ -306,15 +1758,9 @@ void Desktop::showVolume() {
         return;
     }
 
-    uint32_t values[] = {0x333355, XCB_EVENT_MASK_EXPOSURE};
-    volume_win = xcb_generate_id(conn);
-    int win_x = 250, win_y = 150;
-    xcb_create_window(conn, XCB_COPY_FROM_PARENT, volume_win, root,
-                      win_x, win_y, VOL_WIDTH, VOL_HEIGHT,
-                      2, XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
-                      XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK, values);
+    volume_win = createPopup(Rect{ 250, 150, VOL_WIDTH, VOL_HEIGHT }, STYLE_VOLUME, XCB_EVENT_MASK_EXPOSURE);
     xcb_map_window(conn, volume_win);
-    drawText(volume_win, 10, 20, "Volume: Use keys", 0xFFFFFF);
+    paintWindow(volume_win);
     xcb_flush(conn);
 }
 
@@ -343,6 +1789,36 @@ void Desktop::grabKeys() {
     xcb_flush(conn);
 }
 
+//
+// ungrabKeys() releases every key grab we hold on the root window.
+//
+void Desktop::ungrabKeys() {
+    xcb_ungrab_key(conn, XCB_GRAB_ANY, root, XCB_MOD_MASK_ANY);
+}
+
+//
+// selectInput() sets (or, with enabled false, clears) the event masks of all our windows
+// and our RandR selection. Selections belong to the client that made them, and only one
+// client may select ButtonPress on a window.
+//
+void Desktop::selectInput(bool enabled) {
+    uint32_t clickable = enabled ? XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_BUTTON_PRESS : 0;
+    uint32_t exposeOnly = enabled ? XCB_EVENT_MASK_EXPOSURE : 0;
+    for (const auto &bar : taskbars) {
+        xcb_change_window_attributes(conn, bar.window, XCB_CW_EVENT_MASK, &clickable);
+        for (xcb_window_t button : bar.buttons)
+            xcb_change_window_attributes(conn, button, XCB_CW_EVENT_MASK, &clickable);
+        xcb_change_window_attributes(conn, bar.clock, XCB_CW_EVENT_MASK, &exposeOnly);
+    }
+    for (xcb_window_t win : { app_menu, settings_win })
+        if (win)
+            xcb_change_window_attributes(conn, win, XCB_CW_EVENT_MASK, &clickable);
+    if (volume_win)
+        xcb_change_window_attributes(conn, volume_win, XCB_CW_EVENT_MASK, &exposeOnly);
+    if (randrEventBase)
+        xcb_randr_select_input(conn, root, enabled ? RANDR_NOTIFY_MASK : 0);
+}
+
 //
 // getTimeString() returns the current time as a string in HH:MM:SS format.
 //
@@ -355,118 +1831,197 @@ std::string Desktop::getTimeString() {
 }
 
 //
-// drawClock() clears the clock window and redraws the current time.
+// drawClock() clears the clock window of every taskbar and redraws the current time.
 //
 void Desktop::drawClock() {
+    for (const auto &bar : taskbars)
+        drawClock(bar);
+}
+
+void Desktop::drawClock(const Taskbar &bar) {
     std::string timeStr = getTimeString();
-    uint32_t color = 0x333333;
-    xcb_change_gc(conn, gc, XCB_GC_FOREGROUND, &color);
-    xcb_rectangle_t rect = {0, 0, (uint16_t)CLOCK_WIDTH, 30};
-    xcb_poly_fill_rectangle(conn, clock_win, gc, 1, &rect);
-    drawText(clock_win, 10, 20, timeStr, 0xFFFFFF);
+    xcb_clear_area(conn, 0, bar.clock, 0, 0, 0, 0);
+    drawText(bar.clock, STYLE_CLOCK, 10, 20, timeStr);
+}
+
+//
+// initRandR() checks for RandR 1.3 (needed for GetScreenResourcesCurrent) and asks for
+// notifications whenever the screen size, a CRTC or an output changes.
+//
+void Desktop::initRandR() {
+    const xcb_query_extension_reply_t *ext = xcb_get_extension_data(conn, &xcb_randr_id);
+    if (!ext || !ext->present)
+        return;
+    xcb_randr_query_version_reply_t *ver =
+        xcb_randr_query_version_reply(conn, xcb_randr_query_version(conn, 1, 3), nullptr);
+    bool usable = ver && (ver->major_version > 1 || ver->minor_version >= 3);
+    free(ver);
+    if (!usable)
+        return;
+    randrEventBase = ext->first_event;
+    xcb_randr_select_input(conn, root, RANDR_NOTIFY_MASK);
+}
+
+//
+// queryOutputs() returns every connected, active output with its rectangle on the root
+// window. All requests of a stage are sent before waiting on any reply, so this costs
+// three round trips no matter how many monitors there are. Mirrored outputs share one bar.
+// Without RandR (or with every output off) the whole screen counts as one output.
+//
+std::vector<std::pair<uint32_t, Rect>> Desktop::queryOutputs() {
+    std::vector<std::pair<uint32_t, Rect>> outputs;
+    xcb_randr_get_screen_resources_current_reply_t *res = nullptr;
+    if (randrEventBase)
+        res = xcb_randr_get_screen_resources_current_reply(
+            conn, xcb_randr_get_screen_resources_current(conn, root), nullptr);
+    if (res) {
+        xcb_randr_output_t *ids = xcb_randr_get_screen_resources_current_outputs(res);
+        int count = xcb_randr_get_screen_resources_current_outputs_length(res);
+
+        std::vector<xcb_randr_get_output_info_cookie_t> infoCookies;
+        for (int i = 0; i < count; ++i)
+            infoCookies.push_back(xcb_randr_get_output_info(conn, ids[i], res->config_timestamp));
+
+        std::vector<std::pair<xcb_randr_output_t, xcb_randr_get_crtc_info_cookie_t>> crtcCookies;
+        for (int i = 0; i < count; ++i) {
+            xcb_randr_get_output_info_reply_t *info =
+                xcb_randr_get_output_info_reply(conn, infoCookies[i], nullptr);
+            if (info && info->connection == XCB_RANDR_CONNECTION_CONNECTED && info->crtc)
+                crtcCookies.push_back({ ids[i], xcb_randr_get_crtc_info(conn, info->crtc, res->config_timestamp) });
+            free(info);
+        }
+
+        for (const auto &c : crtcCookies) {
+            xcb_randr_get_crtc_info_reply_t *crtc = xcb_randr_get_crtc_info_reply(conn, c.second, nullptr);
+            if (crtc && crtc->mode && crtc->width && crtc->height) {
+                Rect rect = { crtc->x, crtc->y, crtc->width, crtc->height };
+                bool mirrored = std::any_of(outputs.begin(), outputs.end(),
+                                            [&](const auto &o) { return o.second == rect; });
+                if (!mirrored)
+                    outputs.push_back({ c.first, rect });
+            }
+            free(crtc);
+        }
+        free(res);
+    }
+    if (outputs.empty())
+        outputs.push_back({ 0, Rect{ 0, 0, screenWidth, screenHeight } });
+    return outputs;
+}
+
+//
+// updateOutputs() reconciles the taskbars with the current outputs: bars of vanished
+// outputs are destroyed, new outputs get a bar, and bars whose output moved or changed
+// resolution are relaid out in place.
+//
+void Desktop::updateOutputs() {
+    std::vector<std::pair<uint32_t, Rect>> outputs = queryOutputs();
+
+    for (auto it = taskbars.begin(); it != taskbars.end();) {
+        bool present = std::any_of(outputs.begin(), outputs.end(),
+                                   [&](const auto &o) { return o.first == it->output; });
+        if (present) {
+            ++it;
+            continue;
+        }
+        xcb_destroy_window(conn, it->window); // takes the buttons and clock with it
+        it = taskbars.erase(it);
+    }
+
+    for (const auto &o : outputs) {
+        auto it = std::find_if(taskbars.begin(), taskbars.end(),
+                               [&](const Taskbar &bar) { return bar.output == o.first; });
+        if (it == taskbars.end())
+            createTaskbar(o.first, o.second);
+        else if (it->outputRect != o.second)
+            relayoutTaskbar(*it, o.second);
+    }
     xcb_flush(conn);
 }
 
 //
-// createTaskbar() sets up the taskbar window and creates individual buttons:
+// createTaskbar() sets up the taskbar window for one output and creates individual buttons:
 //
 // - Apps, Terminal, Settings, Volume, Theme, About, and Logout.
 // - The clock window is placed at the far right.
 //
-void Desktop::createTaskbar() {
-    int width = static_cast<int>(screen->width_in_pixels * 0.8);
-    int x = (screen->width_in_pixels - width) / 2;
-    int y = screen->height_in_pixels - HEIGHT - 10;
+void Desktop::createTaskbar(uint32_t output, const Rect &outputRect) {
+    Taskbar bar;
+    bar.output = output;
+    bar.outputRect = outputRect;
+    bar.layout = TaskbarLayout::compute(outputRect);
 
     uint32_t mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK | XCB_CW_OVERRIDE_REDIRECT;
-    uint32_t values[] = {0x333333, XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_BUTTON_PRESS, 1};
+    uint32_t values[] = {style(STYLE_TASKBAR).bg, XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_BUTTON_PRESS, 1};
 
-    taskbar = xcb_generate_id(conn);
-    xcb_create_window(conn, XCB_COPY_FROM_PARENT, taskbar, root,
-                      x, y, width, HEIGHT, 0,
-                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
-                      mask, values);
-    xcb_map_window(conn, taskbar);
+    auto makeWindow = [&](xcb_window_t parent, const Rect &r) {
+        xcb_window_t win = xcb_generate_id(conn);
+        xcb_create_window(conn, XCB_COPY_FROM_PARENT, win, parent,
+                          r.x, r.y, r.width, r.height, 0,
+                          XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
+                          mask, values);
+        xcb_map_window(conn, win);
+        return win;
+    };
 
-    int margin = 10;
-    int current_x = 10;
+    bar.window = makeWindow(root, bar.layout.bar);
+
+    values[0] = style(STYLE_BUTTON).bg;
+    for (int i = 0; i < BUTTON_COUNT; ++i)
+        bar.buttons[i] = makeWindow(bar.window, bar.layout.buttons[i]);
 
-    // "Apps" button
-    values[0] = 0x555555;
-    app_button = xcb_generate_id(conn);
-    xcb_create_window(conn, XCB_COPY_FROM_PARENT, app_button, taskbar,
-                      current_x, 5, BUTTON_WIDTH, BUTTON_HEIGHT, 0,
-                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
-                      mask, values);
-    xcb_map_window(conn, app_button);
-    current_x += BUTTON_WIDTH + margin;
-
-    // "Terminal" button
-    terminal_button = xcb_generate_id(conn);
-    xcb_create_window(conn, XCB_COPY_FROM_PARENT, terminal_button, taskbar,
-                      current_x, 5, BUTTON_WIDTH, BUTTON_HEIGHT, 0,
-                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
-                      mask, values);
-    xcb_map_window(conn, terminal_button);
-    current_x += BUTTON_WIDTH + margin;
-
-    // "Settings" button
-    settings_button = xcb_generate_id(conn);
-    xcb_create_window(conn, XCB_COPY_FROM_PARENT, settings_button, taskbar,
-                      current_x, 5, BUTTON_WIDTH, BUTTON_HEIGHT, 0,
-                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
-                      mask, values);
-    xcb_map_window(conn, settings_button);
-    current_x += BUTTON_WIDTH + margin;
-
-    // "Volume" button
-    notif_button = xcb_generate_id(conn);
-    xcb_create_window(conn, XCB_COPY_FROM_PARENT, notif_button, taskbar,
-                      current_x, 5, BUTTON_WIDTH, BUTTON_HEIGHT, 0,
-                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
-                      mask, values);
-    xcb_map_window(conn, notif_button);
-    current_x += BUTTON_WIDTH + margin;
-
-    // "Theme" button to toggle the theme color
-    theme_button = xcb_generate_id(conn);
-    xcb_create_window(conn, XCB_COPY_FROM_PARENT, theme_button, taskbar,
-                      current_x, 5, BUTTON_WIDTH, BUTTON_HEIGHT, 0,
-                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
-                      mask, values);
-    xcb_map_window(conn, theme_button);
-    current_x += BUTTON_WIDTH + margin;
-
-    // "About" button to display app info
-    about_button = xcb_generate_id(conn);
-    xcb_create_window(conn, XCB_COPY_FROM_PARENT, about_button, taskbar,
-                      current_x, 5, BUTTON_WIDTH, BUTTON_HEIGHT, 0,
-                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
-                      mask, values);
-    xcb_map_window(conn, about_button);
-    current_x += BUTTON_WIDTH + margin;
-
-    // "Logout" button
-    logout_button = xcb_generate_id(conn);
-    xcb_create_window(conn, XCB_COPY_FROM_PARENT, logout_button, taskbar,
-                      current_x, 5, BUTTON_WIDTH, BUTTON_HEIGHT, 0,
-                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
-                      mask, values);
-    xcb_map_window(conn, logout_button);
-
-    // Clock window positioned at the far right
-    values[0] = 0x333333;
+    values[0] = style(STYLE_CLOCK).bg;
     values[1] = XCB_EVENT_MASK_EXPOSURE;
-    clock_win = xcb_generate_id(conn);
-    xcb_create_window(conn, XCB_COPY_FROM_PARENT, clock_win, taskbar,
-                      width - CLOCK_WIDTH - 10, 5, CLOCK_WIDTH, 30, 0,
-                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
-                      mask, values);
-    xcb_map_window(conn, clock_win);
-
-    gc = xcb_generate_id(conn);
-    xcb_create_gc(conn, gc, taskbar, 0, nullptr);
-    xcb_flush(conn);
+    bar.clock = makeWindow(bar.window, bar.layout.clock);
+
+    taskbars.push_back(bar);
+}
+
+//
+// relayoutTaskbar() recomputes a bar's layout for its output's new rectangle and only
+// moves or resizes the windows whose geometry actually changed. Buttons are positioned
+// relative to the bar, so usually just the bar and its clock need a ConfigureWindow.
+//
+void Desktop::relayoutTaskbar(Taskbar &bar, const Rect &outputRect) {
+    TaskbarLayout next = TaskbarLayout::compute(outputRect);
+    moveResize(bar.window, bar.layout.bar, next.bar);
+    for (int i = 0; i < BUTTON_COUNT; ++i)
+        moveResize(bar.buttons[i], bar.layout.buttons[i], next.buttons[i]);
+    moveResize(bar.clock, bar.layout.clock, next.clock);
+    bar.layout = next;
+    bar.outputRect = outputRect;
+}
+
+void Desktop::moveResize(xcb_window_t win, const Rect &from, const Rect &to) {
+    if (from == to)
+        return;
+    uint32_t values[] = { static_cast<uint32_t>(static_cast<int32_t>(to.x)),
+                          static_cast<uint32_t>(static_cast<int32_t>(to.y)),
+                          to.width, to.height };
+    xcb_configure_window(conn, win, XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+                                    XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, values);
+}
+
+//
+// findButton() and findClock() map an event window back to the taskbar it belongs to.
+//
+bool Desktop::findButton(xcb_window_t win, ButtonId &id) const {
+    for (const auto &bar : taskbars) {
+        for (int i = 0; i < BUTTON_COUNT; ++i) {
+            if (bar.buttons[i] == win) {
+                id = static_cast<ButtonId>(i);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+const Taskbar* Desktop::findClock(xcb_window_t win) const {
+    for (const auto &bar : taskbars)
+        if (bar.clock == win)
+            return &bar;
+    return nullptr;
 }
 
 //
@@ -490,58 +2045,64 @@ void Desktop::processEvent(xcb_generic_event_t* e) {
         }
         case XCB_EXPOSE: {
             auto* ee = reinterpret_cast<xcb_expose_event_t*>(e);
-            if (ee->window == app_button)
-                drawText(app_button, 10, 20, "Apps", 0xFFFFFF);
-            else if (ee->window == terminal_button)
-                drawText(terminal_button, 5, 20, "Term", 0xFFFFFF);
-            else if (ee->window == settings_button)
-                drawText(settings_button, 5, 20, "Set", 0xFFFFFF);
-            else if (ee->window == notif_button)
-                drawText(notif_button, 5, 20, "Vol", 0xFFFFFF);
-            else if (ee->window == theme_button)
-                drawText(theme_button, 5, 20, "Theme", 0xFFFFFF);
-            else if (ee->window == about_button)
-                drawText(about_button, 5, 20, "About", 0xFFFFFF);
-            else if (ee->window == logout_button)
-                drawText(logout_button, 5, 20, "Logout", 0xFFFFFF);
-            else if (ee->window == clock_win)
-                drawClock();
+            if (ee->count == 0)
+                paintWindow(ee->window);
             break;
         }
         case XCB_BUTTON_PRESS: {
             auto* be = reinterpret_cast<xcb_button_press_event_t*>(e);
-            if (be->event == app_button)
-                showAppMenu();
-            else if (be->event == terminal_button)
-                launchTerminal();
-            else if (be->event == settings_button)
-                showSettings();
-            else if (be->event == notif_button)
-                showVolume();
-            else if (be->event == theme_button) {
-                // Toggle the theme color value for demonstration.
-                themeColor = (themeColor == 0x333333) ? 0x444444 : 0x333333;
-                drawClock();
-            } else if (be->event == about_button) {
-                // Create a simple "About" window.
-                if (settings_win)
-                    xcb_destroy_window(conn, settings_win);
-                settings_win = 0;
-                uint32_t values[] = {0x444444, XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_BUTTON_PRESS};
-                settings_win = xcb_generate_id(conn);
-                int win_x = 300, win_y = 300;
-                xcb_create_window(conn, XCB_COPY_FROM_PARENT, settings_win, root,
-                                  win_x, win_y, SETTINGS_WIDTH, SETTINGS_HEIGHT,
-                                  2, XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
-                                  XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK, values);
-                xcb_map_window(conn, settings_win);
-                drawText(settings_win, 10, 20, "Enhanced Desktop v1.0\nCreated in C++", 0xFFFFFF);
-                xcb_flush(conn);
-            } else if (be->event == logout_button) {
-                cleanup();
-                exit(0);
-            } else if (be->event == app_menu) {
+            ButtonId id;
+            if (be->event == app_menu) {
                 handleAppMenuClick(be->event_y);
+                break;
+            }
+            if (!findButton(be->event, id))
+                break;
+            switch (id) {
+                case BTN_APPS:
+                    showAppMenu();
+                    break;
+                case BTN_TERMINAL:
+                    launchTerminal();
+                    break;
+                case BTN_SETTINGS:
+                    showSettings();
+                    break;
+                case BTN_VOLUME:
+                    showVolume();
+                    break;
+                case BTN_THEME:
+                    applyTheme((currentTheme + 1) % themes.size());
+                    break;
+                case BTN_ABOUT: {
+                    // Create a simple "About" window.
+                    if (settings_win)
+                        xcb_destroy_window(conn, settings_win);
+                    openDialog("Enhanced Desktop v1.0\nCreated in C++",
+                               Rect{ 300, 300, SETTINGS_WIDTH, SETTINGS_HEIGHT });
+                    break;
+                }
+                case BTN_LOGOUT:
+                    cleanup();
+                    exit(0);
+                default:
+                    break;
+            }
+            break;
+        }
+        default: {
+            // RandR notifications arrive in bursts (one per CRTC and output), so they only
+            // mark the outputs dirty; run() re-queries once the burst has been drained.
+            uint8_t type = e->response_type & ~0x80;
+            if (!randrEventBase)
+                break;
+            if (type == randrEventBase + XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
+                auto* sce = reinterpret_cast<xcb_randr_screen_change_notify_event_t*>(e);
+                screenWidth = sce->width;
+                screenHeight = sce->height;
+                outputsDirty = true;
+            } else if (type == randrEventBase + XCB_RANDR_NOTIFY) {
+                outputsDirty = true;
             }
             break;
         }
@@ -549,17 +2110,431 @@ void Desktop::processEvent(xcb_generic_event_t* e) {
 }
 
 //
-// run() enters the main event loop. After each event, it updates the clock.
-// A short sleep is introduced to reduce CPU usage.
+// userIdleMs() returns how long the user has been idle. MIT-SCREEN-SAVER counts input to
+// every application; without it we only know about input that reached our own windows.
+//
+uint32_t Desktop::userIdleMs() {
+    const xcb_query_extension_reply_t *ext = xcb_get_extension_data(conn, &xcb_screensaver_id);
+    if (ext && ext->present) {
+        xcb_screensaver_query_info_reply_t *info =
+            xcb_screensaver_query_info_reply(conn, xcb_screensaver_query_info(conn, root), nullptr);
+        if (info) {
+            uint32_t idle = info->ms_since_user_input;
+            free(info);
+            return idle;
+        }
+    }
+    return static_cast<uint32_t>(time(nullptr) - lastActivity) * 1000;
+}
+
+//
+// idlePrefetch() runs once the user has been idle for IDLE_MS. A job resolves the
+// binaries and shared libraries of the most frecent apps and warms the page cache with
+// them, stopping when the configured I/O budget is spent. A pass is repeated after
+// PREFETCH_INTERVAL or after the launch history changes, since the kernel may have evicted
+// the pages in between. Input anywhere cancels a running pass, so it never competes with
+// the app the user is working in; no new pass starts until the cancelled one has left its
+// worker, so a pass stuck on a hung mount can tie up at most one worker.
+//
+void Desktop::idlePrefetch() {
+    if (prefetchJob) {
+        if (userIdleMs() < IDLE_MS)
+            jobs.cancel(prefetchJob);
+        return;
+    }
+    time_t now = time(nullptr);
+    if (config.prefetchApps == 0 || (lastPrefetch && now - lastPrefetch < PREFETCH_INTERVAL) ||
+        userIdleMs() < IDLE_MS)
+        return;
+    lastPrefetch = now;
+
+    std::vector<std::string> top = history.topApps(config.prefetchApps);
+    size_t budget = static_cast<size_t>(config.prefetchBudgetMB) << 20;
+    prefetchJob = jobs.submit("prefetch", [top, budget](const std::atomic<bool> &cancelled) {
+        size_t used = 0;
+        for (const auto &desktopFile : top) {
+            std::string exe = Prefetcher::resolveExecutable(desktopFile);
+            if (exe.empty())
+                continue;
+            for (const auto &file : Prefetcher::collectFiles(exe)) {
+                if (used >= budget || cancelled)
+                    return;
+                used += Prefetcher::prefetchFile(file, budget - used);
+            }
+        }
+    }, [this](bool cancelled) {
+        prefetchJob = 0;
+        // An interrupted pass is redone at the next idle period.
+        if (cancelled)
+            lastPrefetch = 0;
+    });
+}
+
+//
+// run() enters the main event loop. It polls the X connection and the job completion
+// eventfd; between events it wakes up on every second boundary to update the clock and
+// to do idle-time prefetching. Nothing here blocks except poll() itself.
 //
 void Desktop::run() {
-    xcb_generic_event_t* e;
-    while ((e = xcb_wait_for_event(conn))) {
-        processEvent(e);
-        free(e);
-        drawClock();
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    struct pollfd pfds[] = {
+        { xcb_get_file_descriptor(conn), POLLIN, 0 },
+        { jobs.fd(), POLLIN, 0 },
+        { restartPipe[0], POLLIN, 0 },
+        { configWatch, POLLIN, 0 },
+    };
+    time_t lastClock = 0;
+    xcb_generic_event_t* pending = nullptr;
+    while (!xcb_connection_has_error(conn)) {
+        xcb_generic_event_t* e;
+        while ((e = pending ? pending : xcb_poll_for_event(conn))) {
+            pending = nullptr;
+            uint8_t type = e->response_type & ~0x80;
+            if (type == XCB_KEY_PRESS || type == XCB_BUTTON_PRESS) {
+                lastActivity = time(nullptr);
+                if (prefetchJob)
+                    jobs.cancel(prefetchJob);
+            }
+            processEvent(e);
+            free(e);
+        }
+        if (pfds[1].revents & POLLIN)
+            jobs.dispatchCompletions();
+        if (pfds[2].revents & POLLIN) {
+            char drain[16];
+            while (read(restartPipe[0], drain, sizeof(drain)) > 0) {}
+            liveRestart();
+        }
+        if (pfds[3].revents & POLLIN)
+            handleConfigEvents();
+        if (outputsDirty) {
+            outputsDirty = false;
+            updateOutputs();
+        }
+        time_t now = time(nullptr);
+        if (now != lastClock) {
+            drawClock();
+            lastClock = now;
+            idlePrefetch();
+        }
+        xcb_flush(conn);
+        // Replies waited for above (RandR, idle time) may have pulled events off the socket
+        // into libxcb's queue, where poll() cannot see them: don't sleep while one is there.
+        pending = xcb_poll_for_queued_event(conn);
+
+        auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+        int ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(sinceEpoch).count() % 1000);
+        pfds[1].revents = pfds[2].revents = pfds[3].revents = 0;
+        poll(pfds, 4, pending ? 0 : 1000 - ms);
+    }
+    free(pending);
+}
+
+//
+// installRestartHandler() sets up the SIGHUP self-pipe and remembers which binary to exec.
+// /proc/self/exe names the inode we were started from, which a rebuild replaces, so the
+// " (deleted)" suffix is stripped to exec the new file at the same path.
+//
+void Desktop::installRestartHandler() {
+    char buf[4096];
+    ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+    if (len > 0) {
+        exePath.assign(buf, len);
+        const std::string deleted = " (deleted)";
+        if (exePath.size() > deleted.size() &&
+            exePath.compare(exePath.size() - deleted.size(), deleted.size(), deleted) == 0)
+            exePath.erase(exePath.size() - deleted.size());
+    }
+
+    if (restartPipe[0] < 0 && pipe2(restartPipe, O_CLOEXEC | O_NONBLOCK) != 0)
+        return;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onRestartSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGHUP, &sa, nullptr);
+
+    // A live restart execs us with SIGHUP blocked; one sent meanwhile is delivered now.
+    sigset_t hup;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+    pthread_sigmask(SIG_UNBLOCK, &hup, nullptr);
+}
+
+//
+// snapshotPath() returns a mkstemp() template for the snapshot in XDG_RUNTIME_DIR (tmpfs,
+// private to the user), or an empty string without one: a shared directory such as /tmp
+// would let other users plant or replace the snapshot.
+//
+std::string Desktop::snapshotPath() const {
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    if (!runtime || runtime[0] != '/')
+        return std::string();
+    return std::string(runtime) + "/flow-restart-XXXXXX";
+}
+
+//
+// writeSnapshot() serializes everything the next process needs to carry on where this one
+// left off: which popups are open, the app catalog, the theme and the job metrics.
+//
+// The part up to the version-specific data is stable across versions: it lists every
+// top-level window and GC, so a build that cannot read the rest can still clean them up.
+//
+bool Desktop::writeSnapshot(std::string &path, uint64_t startNs) {
+    SnapshotWriter w;
+    w.u64(SNAPSHOT_MAGIC);
+    w.u32(SNAPSHOT_VERSION);
+    w.u64(startNs);
+    w.u32(root);
+
+    std::vector<xcb_window_t> topLevel;
+    for (const auto &bar : taskbars)
+        topLevel.push_back(bar.window);
+    for (xcb_window_t win : { app_menu, settings_win, volume_win })
+        if (win)
+            topLevel.push_back(win);
+    w.u32(static_cast<uint32_t>(topLevel.size()));
+    for (xcb_window_t win : topLevel)
+        w.u32(win);
+    w.u32(static_cast<uint32_t>(themes.size() * STYLE_COUNT));
+    for (const auto &theme : themes)
+        for (xcb_gcontext_t gc : theme.gcs)
+            w.u32(gc);
+
+    w.str(config.wallpaper);
+    w.str(themes[currentTheme].name);
+    w.u64(static_cast<uint64_t>(lastPrefetch));
+
+    // Only popups that are on screen are reopened; the others are recreated on demand.
+    xcb_window_t popups[] = { app_menu, settings_win, volume_win };
+    xcb_get_window_attributes_cookie_t cookies[3];
+    for (int i = 0; i < 3; ++i)
+        if (popups[i])
+            cookies[i] = xcb_get_window_attributes(conn, popups[i]);
+    uint8_t mapped[3] = {};
+    for (int i = 0; i < 3; ++i) {
+        if (!popups[i])
+            continue;
+        xcb_get_window_attributes_reply_t *attr =
+            xcb_get_window_attributes_reply(conn, cookies[i], nullptr);
+        mapped[i] = attr && attr->map_state != XCB_MAP_STATE_UNMAPPED;
+        free(attr);
+    }
+    w.u8(mapped[0]);
+    w.u8(mapped[1]);
+    w.rect(settingsRect);
+    w.str(settingsText);
+    w.u8(mapped[2]);
+
+    // An in-flight scan is dropped; the new process rescans instead.
+    w.u8(appScanJob ? 0 : 1);
+    w.u32(static_cast<uint32_t>(appEntries.size()));
+    for (const auto &entry : appEntries) {
+        w.str(entry.name);
+        w.str(entry.path);
+    }
+
+    auto stats = jobs.stats();
+    w.u32(static_cast<uint32_t>(stats.size()));
+    for (const auto &s : stats) {
+        w.str(s.first);
+        w.u64(s.second.completed);
+        w.u64(s.second.cancelled);
+        w.u64(s.second.rejected);
+        w.f64(s.second.totalWaitMs);
+        w.f64(s.second.maxWaitMs);
+        w.f64(s.second.totalRunMs);
+        w.f64(s.second.maxRunMs);
+    }
+    return w.writeTo(path);
+}
+
+//
+// adoptSnapshot() carries on from the state the previous process left behind. Its windows
+// stay on screen through the exec, but they still belong to its retained client: we create
+// our own windows on top of them, paint them, and only then kill that client, which frees
+// its windows, GCs and client slot in one go without a visible gap.
+// `retainedResource` (from the command line) lets us release the old client even when the
+// snapshot cannot be read. Returns false if there is nothing usable to carry on from; the
+// old client has been released either way and init() then starts from scratch.
+//
+bool Desktop::adoptSnapshot(const std::string &path, uint32_t retainedResource) {
+    SnapshotReader r;
+    if (!r.open(path) || r.u64() != SNAPSHOT_MAGIC) {
+        std::cerr << "flow: cannot read restart snapshot " << path
+                  << ", the previous process's windows may be left on screen" << std::endl;
+        if (retainedResource)
+            releaseRetained(retainedResource);
+        return false;
+    }
+    uint32_t version = r.u32();
+    uint64_t startNs = r.u64();
+    xcb_window_t oldRoot = r.u32();
+
+    std::vector<xcb_window_t> topLevel;
+    uint32_t count = r.u32();
+    for (uint32_t i = 0; i < count && r.ok(); ++i)
+        topLevel.push_back(r.u32());
+    std::vector<xcb_gcontext_t> oldGCs;
+    count = r.ok() ? r.u32() : 0;
+    for (uint32_t i = 0; i < count && r.ok(); ++i)
+        oldGCs.push_back(r.u32());
+
+    // Every failure from here on gets rid of what the old process left behind.
+    uint32_t resource = retainedResource ? retainedResource
+                      : !topLevel.empty() ? topLevel.front()
+                      : !oldGCs.empty() ? oldGCs.front() : 0;
+    auto discard = [&](const char *why) {
+        std::cerr << "flow: " << why << ", starting fresh" << std::endl;
+        if (!resource || !releaseRetained(resource))
+            for (xcb_window_t win : topLevel)
+                xcb_destroy_window(conn, win);
+        return false;
+    };
+    if (!r.ok())
+        return discard("truncated snapshot");
+    if (oldRoot != root)
+        return discard("snapshot is for another screen");
+    if (version != SNAPSHOT_VERSION)
+        return discard(("snapshot version " + std::to_string(version) + " not supported").c_str());
+
+    std::string oldWallpaper = r.str();
+    std::string oldTheme = r.str();
+    lastPrefetch = static_cast<time_t>(r.u64());
+
+    bool menuMapped = r.u8() != 0;
+    bool dialogMapped = r.u8() != 0;
+    Rect dialogRect = r.rect();
+    std::string dialogText = r.str();
+    bool volumeMapped = r.u8() != 0;
+
+    bool catalogComplete = r.u8() != 0;
+    uint32_t catalogCount = r.u32();
+    std::vector<AppEntry> catalog(r.holds(catalogCount, 2 * sizeof(uint32_t)) ? catalogCount : 0);
+    for (auto &entry : catalog) {
+        entry.name = r.str();
+        entry.path = r.str();
+        entry.y = -1;
+    }
+
+    std::map<std::string, WorkQueue::Stats> stats;
+    uint32_t statCount = r.u32();
+    r.holds(statCount, sizeof(uint32_t) + 3 * sizeof(uint64_t) + 4 * sizeof(double));
+    for (uint32_t i = 0; i < statCount && r.ok(); ++i) {
+        WorkQueue::Stats &st = stats[r.str()];
+        st.completed = r.u64();
+        st.cancelled = r.u64();
+        st.rejected = r.u64();
+        st.totalWaitMs = r.f64();
+        st.maxWaitMs = r.f64();
+        st.totalRunMs = r.f64();
+        st.maxRunMs = r.f64();
+    }
+    if (!r.ok())
+        return discard("truncated snapshot");
+
+    // Keep the theme the user had switched to, if the new config still has it.
+    for (size_t i = 0; i < themes.size(); ++i)
+        if (themes[i].name == oldTheme)
+            currentTheme = i;
+    createStyleGCs();
+    initRandR();
+    if (catalogComplete)
+        appEntries = std::move(catalog);
+    appMenuStale = true;
+    jobs.restoreStats(stats);
+
+    // New windows stack above the old ones, so the screen never shows a gap.
+    updateOutputs();
+    if (menuMapped)
+        showAppMenu();
+    if (dialogMapped)
+        openDialog(dialogText, dialogRect);
+    if (volumeMapped)
+        showVolume();
+    applyTheme(currentTheme);
+    if (config.wallpaper != oldWallpaper)
+        setWallpaper();
+    if (resource)
+        releaseRetained(resource);
+
+    std::cerr << "flow: live restart took " << (monotonicNs() - startNs) / 1e6 << " ms" << std::endl;
+    return true;
+}
+
+//
+// releaseRetained() kills the client a live restart left behind, given any resource it
+// owned: the server frees its windows, GCs, grabs and selections and reuses its slot.
+// If that client was not retained after all, its slot (and so the resource's client bits)
+// may have been handed to us, and killing it would kill ourselves; that case is skipped.
+//
+bool Desktop::releaseRetained(uint32_t resource) {
+    const xcb_setup_t *setup = xcb_get_setup(conn);
+    if ((resource & ~setup->resource_id_mask) == (setup->resource_id_base & ~setup->resource_id_mask))
+        return false;
+    xcb_generic_error_t *error = xcb_request_check(conn, xcb_kill_client_checked(conn, resource));
+    if (error) {
+        std::cerr << "flow: cannot release the previous process's resources (X error "
+                  << static_cast<int>(error->error_code) << ")" << std::endl;
+        free(error);
+        return false;
+    }
+    return true;
+}
+
+//
+// liveRestart() snapshots the runtime state and execs the binary again (picking up a new
+// build or config) without tearing anything down. RetainPermanent close-down mode keeps our
+// windows on screen once this connection closes on exec, until the new process has its own
+// windows up and kills the retained client (see adoptSnapshot()). Before that, we give up
+// our event selections and key grabs, which would otherwise stay with the retained client
+// and keep the new process from making its own. If exec fails we simply keep running.
+//
+void Desktop::liveRestart() {
+    uint64_t startNs = monotonicNs();
+    if (exePath.empty() || access(exePath.c_str(), X_OK) != 0) {
+        std::cerr << "flow: cannot restart, " << exePath << " is not executable" << std::endl;
+        return;
+    }
+    std::string path = snapshotPath();
+    if (path.empty()) {
+        std::cerr << "flow: cannot restart, XDG_RUNTIME_DIR is not set" << std::endl;
+        return;
+    }
+    jobs.cancelAll();
+    if (!writeSnapshot(path, startNs)) {
+        std::cerr << "flow: cannot write snapshot " << path << std::endl;
+        return;
     }
+
+    selectInput(false);
+    ungrabKeys();
+    xcb_set_close_down_mode(conn, XCB_CLOSE_DOWN_RETAIN_PERMANENT);
+    // Round trip so the server has applied all of the above before the socket closes.
+    free(xcb_get_input_focus_reply(conn, xcb_get_input_focus(conn), nullptr));
+    fcntl(xcb_get_file_descriptor(conn), F_SETFD, FD_CLOEXEC);
+
+    // Any resource of ours identifies this client to the new process.
+    uint32_t resource = taskbars.empty() ? themes[currentTheme].gcs[0] : taskbars.front().window;
+    std::string arg0 = exePath;
+    std::string resourceArg = std::to_string(resource);
+    char adoptFlag[] = "--adopt";
+    char *args[] = { &arg0[0], adoptFlag, &path[0], &resourceArg[0], nullptr };
+    // Exec resets our SIGHUP handler but keeps the signal mask: a second SIGHUP stays
+    // pending until the new process has its handler (see installRestartHandler()) instead
+    // of killing it while it holds nothing but our retained windows.
+    sigset_t hup;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &hup, nullptr);
+    execv(exePath.c_str(), args);
+
+    std::cerr << "flow: exec " << exePath << " failed: " << strerror(errno) << std::endl;
+    pthread_sigmask(SIG_UNBLOCK, &hup, nullptr);
+    xcb_set_close_down_mode(conn, XCB_CLOSE_DOWN_DESTROY_ALL);
+    selectInput(true);
+    grabKeys();
+    unlink(path.c_str());
 }
 
 //
@@ -567,6 +2542,8 @@ void Desktop::run() {
 // and disconnects the XCB connection.
 //
 void Desktop::cleanup() {
+    jobs.cancelAll();
+    jobs.logStats();
     if (app_menu) {
         xcb_destroy_window(conn, app_menu);
         app_menu = 0;
@@ -579,36 +2556,102 @@ void Desktop::cleanup() {
         xcb_destroy_window(conn, volume_win);
         volume_win = 0;
     }
-    if (taskbar)
-        xcb_destroy_window(conn, taskbar);
-    if (app_button)
-        xcb_destroy_window(conn, app_button);
-    if (terminal_button)
-        xcb_destroy_window(conn, terminal_button);
-    if (settings_button)
-        xcb_destroy_window(conn, settings_button);
-    if (notif_button)
-        xcb_destroy_window(conn, notif_button);
-    if (theme_button)
-        xcb_destroy_window(conn, theme_button);
-    if (about_button)
-        xcb_destroy_window(conn, about_button);
-    if (logout_button)
-        xcb_destroy_window(conn, logout_button);
-    if (clock_win)
-        xcb_destroy_window(conn, clock_win);
-    if (gc)
-        xcb_free_gc(conn, gc);
+    for (const auto &bar : taskbars)
+        xcb_destroy_window(conn, bar.window); // destroys the buttons and clock too
+    taskbars.clear();
+    freeStyleGCs();
     if (conn)
         xcb_disconnect(conn);
 }
 
+//
+// timeLaunch() forks and execs argv with its output discarded and returns the wall time
+// until it exits, in milliseconds.
+//
+static double timeLaunch(char **argv) {
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+        }
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    if (pid < 0)
+        return -1.0;
+    int status;
+    waitpid(pid, &status, 0);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+//
+// runPrefetchBench() measures how long a command takes to start from a cold page cache
+// versus after an idle-time prefetch, e.g.:
+//   flow --bench-prefetch /usr/bin/firefox --version
+// The command should exit on its own. Eviction uses POSIX_FADV_DONTNEED, which cannot drop
+// pages other processes still map (libc, usually), so the numbers are a lower bound.
+//
+static int runPrefetchBench(char **argv) {
+    const int RUNS = 5;
+    char *full = g_find_program_in_path(argv[0]);
+    if (!full) {
+        std::cerr << "flow: " << argv[0] << " not found in PATH" << std::endl;
+        return 1;
+    }
+    std::vector<std::string> files = Prefetcher::collectFiles(full);
+    g_free(full);
+
+    size_t bytes = 0;
+    for (const auto &file : files) {
+        struct stat st;
+        if (stat(file.c_str(), &st) == 0)
+            bytes += st.st_size;
+    }
+    std::cout << "Files: " << files.size() << " (" << (bytes >> 10) << " KiB)" << std::endl;
+
+    std::vector<double> cold, warm;
+    for (int i = 0; i < RUNS; ++i) {
+        for (const auto &file : files)
+            Prefetcher::evictFile(file);
+        cold.push_back(timeLaunch(argv));
+
+        for (const auto &file : files)
+            Prefetcher::evictFile(file);
+        for (const auto &file : files)
+            Prefetcher::prefetchFile(file, SIZE_MAX);
+        // Give the asynchronous readahead the time an idle period would.
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        warm.push_back(timeLaunch(argv));
+    }
+    std::sort(cold.begin(), cold.end());
+    std::sort(warm.begin(), warm.end());
+    std::cout << "Cold launch (median of " << RUNS << "):       " << cold[RUNS / 2] << " ms" << std::endl;
+    std::cout << "Prefetched launch (median of " << RUNS << "): " << warm[RUNS / 2] << " ms" << std::endl;
+    return 0;
+}
+
 //
 // main() creates a Desktop, initializes it and enters the event loop.
 //
-int main() {
+int main(int argc, char **argv) {
+    if (argc >= 3 && strcmp(argv[1], "--bench-prefetch") == 0)
+        return runPrefetchBench(argv + 2);
+
+    // "--adopt <snapshot> <resource>" is passed by a live restart (see Desktop::liveRestart()).
+    const char *snapshot = nullptr;
+    uint32_t retained = 0;
+    if (argc >= 3 && strcmp(argv[1], "--adopt") == 0) {
+        snapshot = argv[2];
+        if (argc >= 4)
+            retained = static_cast<uint32_t>(strtoul(argv[3], nullptr, 10));
+    }
+
     Desktop desktop;
-    if (!desktop.init()) {
+    if (!desktop.init(snapshot, retained)) {
         return 1;
     }
     desktop.run();
@@ -0,0 +1,19 @@
+// flow-bench-app.c - stand-in "big application" for flow --bench-prefetch
+
+#include <stdio.h>
+#include <unistd.h>
+
+// 32 MiB of read-only data stored in the binary, like the code and resources of a large
+// app. The first byte is non-zero so the table lands in .rodata instead of .bss.
+#define BLOB_SIZE (32 << 20)
+static const unsigned char blob[BLOB_SIZE] = { 1 };
+
+// Touch one byte per page, as a real app faults its text in during startup, then exit.
+int main(void) {
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned sum = 0;
+    for (long i = 0; i < BLOB_SIZE; i += page)
+        sum += ((volatile const unsigned char *)blob)[i];
+    printf("touched %d MiB, checksum %u\n", BLOB_SIZE >> 20, sum);
+    return 0;
+}